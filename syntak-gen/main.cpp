@@ -0,0 +1,122 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <cstdio>
+#include <algorithm>
+
+#include <QString>
+#include <QStringList>
+#include <QFile>
+
+#include "Rules.h"
+#include "ParserGenerator.h"
+
+/* syntak-gen [-c ClassName] [-o output.h] grammar
+
+   Reads rules in the notation of Rules::toDefinitionString()
+   and writes a parser for them, see ParserGenerator.
+   The class name defaults to the capitalized base name of the
+   grammar file plus "Parser", the output to stdout. */
+
+namespace {
+
+    int fail(const QString& message)
+    {
+        fputs(("syntak-gen: " + message + "\n").toUtf8().constData(), stderr);
+        return 1;
+    }
+
+    /** "dir/calc_ops.syn" -> "CalcOpsParser" */
+    QString defaultClassName(const QString& fileName)
+    {
+        QString base = fileName.mid(std::max(fileName.lastIndexOf('/'),
+                                              fileName.lastIndexOf('\\')) + 1);
+        if (base.indexOf('.') > 0)
+            base = base.left(base.indexOf('.'));
+        QString name;
+        bool upper = true;
+        for (int i=0; i<base.size(); ++i)
+        {
+            if (!base[i].isLetterOrNumber())
+                upper = true;
+            else
+            {
+                name += upper ? base[i].toUpper() : base[i];
+                upper = false;
+            }
+        }
+        return ParserGenerator::identifier(name + "Parser");
+    }
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    QString input, output, className;
+    for (int i=1; i<argc; ++i)
+    {
+        const QString arg = QString::fromLocal8Bit(argv[i]);
+        if ((arg == "-o" || arg == "-c") && i + 1 < argc)
+            (arg == "-o" ? output : className)
+                    = QString::fromLocal8Bit(argv[++i]);
+        else if (input.isEmpty() && !arg.startsWith("-"))
+            input = arg;
+        else
+            return fail("usage: syntak-gen [-c ClassName] [-o output.h] "
+                        "grammar");
+    }
+    if (input.isEmpty())
+        return fail("usage: syntak-gen [-c ClassName] [-o output.h] grammar");
+
+    QFile in(input);
+    if (!in.open(QIODevice::ReadOnly))
+        return fail("can not read " + input);
+    QString error;
+    const Rules rules = Rules::fromDefinitionString(
+                QString::fromUtf8(in.readAll()), &error);
+    if (!error.isEmpty())
+        return fail(input + ": " + error);
+
+    ParserGenerator gen(rules);
+    gen.setClassName(className.isEmpty() ? defaultClassName(input)
+                                         : className);
+    gen.setSourceName(input.mid(std::max(input.lastIndexOf('/'),
+                                         input.lastIndexOf('\\')) + 1));
+    const QByteArray source = gen.generate().toUtf8();
+    if (!gen.errors().isEmpty())
+        return fail(input + ": " + gen.errors().join("\n"));
+
+    if (output.isEmpty())
+    {
+        fwrite(source.constData(), 1, source.size(), stdout);
+        return 0;
+    }
+    QFile out(output);
+    if (!out.open(QIODevice::WriteOnly)
+            || out.write(source) != source.size())
+        return fail("can not write " + output);
+    return 0;
+}
@@ -0,0 +1,20 @@
+# Generates a parser header with syntak-gen from every file in GRAMMARS.
+# For calc.syn this is calc_parser.h with class CalcParser, made again
+# whenever the grammar file or syntak-gen changes.
+# The parser is compiled against syntak, add ../syntak to INCLUDEPATH.
+#
+#   GRAMMARS += calc.syn
+#   include(../syntak-gen/syntak-gen.pri)
+
+isEmpty(SYNTAK_GEN): SYNTAK_GEN = $$shadowed($$PWD)/syntak-gen
+
+syntak_gen.name = syntak-gen ${QMAKE_FILE_IN}
+syntak_gen.input = GRAMMARS
+syntak_gen.output = ${QMAKE_FILE_BASE}_parser.h
+syntak_gen.commands = $$SYNTAK_GEN -o ${QMAKE_FILE_OUT} ${QMAKE_FILE_IN}
+syntak_gen.depends = $$SYNTAK_GEN
+syntak_gen.variable_out = HEADERS
+syntak_gen.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += syntak_gen
+
+OTHER_FILES += $$GRAMMARS
@@ -0,0 +1,37 @@
+#-------------------------------------------------
+#
+# Generates parsers from rule definitions,
+# see syntak-gen.pri for the use in a project
+#
+#-------------------------------------------------
+
+QT       += core
+QT       -= gui
+
+TARGET = syntak-gen
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../syntak
+
+SOURCES += \
+    ../syntak/Tokens.cpp \
+    ../syntak/TokenDfa.cpp \
+    ../syntak/Scanner.cpp \
+    ../syntak/Utf8Input.cpp \
+    ../syntak/Rules.cpp \
+    ../syntak/ParserGenerator.cpp \
+    main.cpp
+
+HEADERS += \
+    ../syntak/Tokens.h \
+    ../syntak/TokenDfa.h \
+    ../syntak/Scanner.h \
+    ../syntak/Utf8Input.h \
+    ../syntak/Rules.h \
+    ../syntak/ParserGenerator.h
+
+OTHER_FILES += \
+    syntak-gen.pri
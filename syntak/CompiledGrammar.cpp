@@ -0,0 +1,135 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <QFile>
+
+#include "CompiledGrammar.h"
+#include "GrammarData.h"
+
+namespace
+{
+    /** "SYNG", start of toData() */
+    const quint32 P_MAGIC = 0x53594e47;
+}
+
+CompiledGrammar::CompiledGrammar(const Tokens& lexxer, const Rules& rules)
+    : p_lexxer      (lexxer)
+    , p_rules       (rules)
+{
+    p_rules.check();
+    // an empty table for rules with errors()
+    p_table.reset(new ParseTable(p_rules.isValid() ? p_rules : Rules()));
+    // nothing is built lazily after this, Parser::parse(const Utf8Input&)
+    // uses the TokenDfa in every mode
+    p_lexxer.prepare(true);
+    p_threadSafe = p_lexxer.isThreadSafe();
+
+    p_symbolOf.assign(p_lexxer.tokens().size() + 1, -1);
+    p_symbolOf[Tokens::K_EOF] = Rules::ID_EOF;
+    for (size_t k=1; k<p_symbolOf.size(); ++k)
+    {
+        int id = p_rules.id(p_lexxer.name(k));
+        if (id >= 0 && p_rules.rule(id)->type() == Rule::T_TOKEN)
+            p_symbolOf[k] = id;
+    }
+}
+
+QByteArray CompiledGrammar::toData() const
+{
+    QByteArray data;
+    QDataStream s(&data, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_5_0);
+    s << P_MAGIC << quint32(DATA_VERSION);
+    s << p_lexxer << p_rules << *p_table;
+    GrammarData::write(s, p_symbolOf);
+    return data;
+}
+
+std::shared_ptr<const CompiledGrammar>
+    CompiledGrammar::fromData(const QByteArray& data, QString* error)
+{
+    QDataStream s(data);
+    s.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, version = 0;
+    s >> magic >> version;
+    if (magic != P_MAGIC || version != DATA_VERSION)
+    {
+        if (error)
+            *error = magic != P_MAGIC
+                    ? QString("not a grammar")
+                    : QString("grammar version %1, expected %2")
+                      .arg(version).arg(int(DATA_VERSION));
+        return nullptr;
+    }
+
+    std::shared_ptr<CompiledGrammar> g(new CompiledGrammar());
+    std::unique_ptr<ParseTable> table(new ParseTable());
+    s >> g->p_lexxer >> g->p_rules >> *table;
+    GrammarData::read(s, g->p_symbolOf);
+
+    // indices the parser relies on
+    if (s.status() == QDataStream::Ok)
+    {
+        const int numIds = g->p_rules.numIds();
+        if (g->p_symbolOf.size() != g->p_lexxer.tokens().size() + 1
+                || (g->p_rules.isValid() && !table->isValidFor(g->p_rules)))
+            s.setStatus(QDataStream::ReadCorruptData);
+        for (int id : g->p_symbolOf)
+            if (id < -1 || id >= numIds)
+                s.setStatus(QDataStream::ReadCorruptData);
+    }
+    if (s.status() != QDataStream::Ok)
+    {
+        if (error)
+            *error = "corrupt grammar data";
+        return nullptr;
+    }
+
+    g->p_table = std::move(table);
+    // no-op unless the data lacks a table
+    g->p_lexxer.prepare(true);
+    g->p_threadSafe = g->p_lexxer.isThreadSafe();
+    return g;
+}
+
+std::shared_ptr<const CompiledGrammar>
+    CompiledGrammar::load(const QString& fileName, QString* error)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        if (error)
+            *error = "can not open " + fileName;
+        return nullptr;
+    }
+    // the mapped bytes are read in place, not copied
+    const uchar* mapped = file.map(0, file.size());
+    if (!mapped)
+        return fromData(file.readAll(), error);
+    return fromData(QByteArray::fromRawData(
+                        reinterpret_cast<const char*>(mapped), file.size()),
+                    error);
+}
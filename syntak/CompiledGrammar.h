@@ -0,0 +1,101 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef COMPILEDGRAMMAR_H
+#define COMPILEDGRAMMAR_H
+
+#include <memory>
+#include <vector>
+
+#include <QByteArray>
+
+#include "Tokens.h"
+#include "Rules.h"
+#include "ParseTable.h"
+
+/** Tokens and Rules, checked and compiled for parsing.
+
+    Never changes after construction. One instance is shared through
+    a std::shared_ptr by any number of Parsers, each holding the state
+    of its own parse, also in different threads if isThreadSafe().
+    The Rules are copied with their callbacks, which are then called
+    from every thread; see Parser::connect() for callbacks per Parser.
+
+    toData() writes everything that was checked and compiled,
+    fromData() restores it without doing any of that work again. */
+class CompiledGrammar
+{
+public:
+    CompiledGrammar(const Tokens& lexxer, const Rules& rules);
+
+    static std::shared_ptr<const CompiledGrammar>
+        create(const Tokens& lexxer, const Rules& rules)
+        { return std::make_shared<const CompiledGrammar>(lexxer, rules); }
+
+    /** Version of the format written by toData() */
+    enum { DATA_VERSION = 1 };
+
+    /** The grammar as a versioned binary blob: tokens, the lexxer
+        tables, rules with their symbol ids, resolved subrules, FIRST
+        sets and alternatives, and the ParseTable.
+        Callbacks are not written, connect them by rule name with
+        Parser::connect() after fromData(). */
+    QByteArray toData() const;
+    /** Restores a grammar from toData(). Returns NULL, with the reason
+        in @p error, if @p data is not a grammar of DATA_VERSION.
+        Nothing is checked or compiled again, the data is trusted
+        apart from the indices that would break parsing. */
+    static std::shared_ptr<const CompiledGrammar>
+        fromData(const QByteArray& data, QString* error = nullptr);
+    /** Maps file @p fileName into memory and reads it with fromData() */
+    static std::shared_ptr<const CompiledGrammar>
+        load(const QString& fileName, QString* error = nullptr);
+
+    const Tokens& lexxer() const { return p_lexxer; }
+    /** The checked copy of the rules, see Rules::errors() */
+    const Rules& rules() const { return p_rules; }
+    /** The LL(1) table of the rules, see ParseTable::conflicts() */
+    const ParseTable& parseTable() const { return *p_table; }
+
+    /** Rules symbol id per LexxedToken kind, or -1 */
+    int symbolOf(int kind) const { return p_symbolOf[kind]; }
+
+    /** Parsers in different threads may share this grammar,
+        false if a Token is not Token::isThreadSafe() */
+    bool isThreadSafe() const { return p_threadSafe; }
+
+private:
+    /** Empty, for fromData() */
+    CompiledGrammar() : p_threadSafe(true) { }
+
+    Tokens p_lexxer;
+    Rules p_rules;
+    std::unique_ptr<const ParseTable> p_table;
+    std::vector<int> p_symbolOf;
+    bool p_threadSafe;
+};
+
+#endif // COMPILEDGRAMMAR_H
@@ -0,0 +1,125 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef GRAMMARDATA_H
+#define GRAMMARDATA_H
+
+#include <vector>
+
+#include <QDataStream>
+#include <QStringList>
+
+/** Helpers for the binary grammar format, see CompiledGrammar::toData().
+    A read fails on the first error, the stream status is then
+    not QDataStream::Ok. */
+namespace GrammarData
+{
+    /** Containers larger than this are taken as corrupt data */
+    enum { MAX_SIZE = 1 << 26 };
+
+    template <class T>
+    void write(QDataStream& s, const T& x) { s << x; }
+
+    template <class T>
+    bool read(QDataStream& s, T& x)
+        { s >> x; return s.status() == QDataStream::Ok; }
+
+    inline bool readSize(QDataStream& s, quint32* n)
+    {
+        s >> *n;
+        if (s.status() == QDataStream::Ok && *n <= MAX_SIZE)
+            return true;
+        s.setStatus(QDataStream::ReadCorruptData);
+        return false;
+    }
+
+    inline void write(QDataStream& s, const std::vector<bool>& v)
+    {
+        s << quint32(v.size());
+        for (bool x : v)
+            s << x;
+    }
+
+    inline bool read(QDataStream& s, std::vector<bool>& v)
+    {
+        quint32 n;
+        if (!readSize(s, &n))
+            return false;
+        v.assign(n, false);
+        for (quint32 i=0; i<n; ++i)
+        {
+            bool x;
+            s >> x;
+            v[i] = x;
+        }
+        return s.status() == QDataStream::Ok;
+    }
+
+    inline void write(QDataStream& s, const QStringList& l)
+    {
+        s << quint32(l.size());
+        for (const QString& x : l)
+            s << x;
+    }
+
+    inline bool read(QDataStream& s, QStringList& l)
+    {
+        quint32 n;
+        if (!readSize(s, &n))
+            return false;
+        l.clear();
+        for (quint32 i=0; i<n; ++i)
+        {
+            QString x;
+            s >> x;
+            l << x;
+        }
+        return s.status() == QDataStream::Ok;
+    }
+
+    template <class T>
+    void write(QDataStream& s, const std::vector<T>& v)
+    {
+        s << quint32(v.size());
+        for (const T& x : v)
+            write(s, x);
+    }
+
+    template <class T>
+    bool read(QDataStream& s, std::vector<T>& v)
+    {
+        quint32 n;
+        if (!readSize(s, &n))
+            return false;
+        v.resize(n);
+        for (T& x : v)
+            if (!read(s, x))
+                return false;
+        return true;
+    }
+}
+
+#endif // GRAMMARDATA_H
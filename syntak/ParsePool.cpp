@@ -0,0 +1,104 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <atomic>
+#include <thread>
+
+#include <QThread>
+#include <QElapsedTimer>
+
+#include "ParsePool.h"
+
+ParsePool::ParsePool(std::shared_ptr<const CompiledGrammar> grammar)
+    : p_grammar     (grammar)
+    , p_numThreads  (0)
+    , p_numDocs     (0)
+    , p_numChars    (0)
+    , p_nsecs       (0)
+{
+    if (!p_grammar->isThreadSafe())
+        p_numThreads = 1;
+}
+
+void ParsePool::parseEach(const QStringList& inputs, DoneFunc done)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    int threads = p_numThreads > 0 ? p_numThreads
+                                   : QThread::idealThreadCount();
+    if (!p_grammar->isThreadSafe())
+        threads = 1;
+    threads = std::max(1, std::min(threads, inputs.size()));
+
+    while (int(p_parsers.size()) < threads)
+    {
+        p_parsers.emplace_back(new Parser(p_grammar));
+        // the workers already use the cores
+        p_parsers.back()->setLexxerThreads(1);
+        if (p_init)
+            p_init(*p_parsers.back(), p_parsers.size() - 1);
+    }
+
+    // blocks small enough to balance, large enough to not contend
+    const int block = std::max(1, std::min(64, inputs.size() / (threads * 8)));
+    std::atomic<int> next(0);
+    p_docsPerWorker.assign(threads, 0);
+
+    auto work = [&](int worker)
+    {
+        Parser& parser = *p_parsers[worker];
+        int count = 0;
+        for (;;)
+        {
+            const int begin = next.fetch_add(block);
+            if (begin >= inputs.size())
+                break;
+            const int end = std::min(begin + block, inputs.size());
+            for (int i = begin; i < end; ++i)
+            {
+                parser.parse(inputs[i]);
+                if (done)
+                    done(parser, worker, i);
+            }
+            count += end - begin;
+        }
+        p_docsPerWorker[worker] = count;
+    };
+
+    std::vector<std::thread> workers;
+    for (int i=1; i<threads; ++i)
+        workers.push_back(std::thread(work, i));
+    work(0);
+    for (auto& w : workers)
+        w.join();
+
+    p_numDocs = inputs.size();
+    p_numChars = 0;
+    for (const QString& s : inputs)
+        p_numChars += s.size();
+    p_nsecs = timer.nsecsElapsed();
+}
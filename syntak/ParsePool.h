@@ -0,0 +1,108 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef PARSEPOOL_H
+#define PARSEPOOL_H
+
+#include <memory>
+#include <vector>
+#include <functional>
+
+#include <QStringList>
+
+#include "Parser.h"
+
+/** Parses many independent texts with one CompiledGrammar
+    on several threads.
+
+    Every worker thread keeps its own Parser for the lifetime of the
+    pool, so buffers are reused from one text and one batch to the
+    next. Workers take small blocks of texts from a shared counter,
+    a worker that is done early takes over the remaining blocks.
+    The Parsers of the workers lex single-threaded,
+    see Parser::setLexxerThreads(). */
+class ParsePool
+{
+public:
+    /** Called once for the Parser of each worker, e.g. to connect
+        callbacks that write to per-worker state */
+    typedef std::function<void(Parser& parser, int worker)> InitFunc;
+    /** Called on the worker thread right after text @p index
+        was parsed by @p parser */
+    typedef std::function<void(Parser& parser, int worker, int index)>
+        DoneFunc;
+
+    explicit ParsePool(std::shared_ptr<const CompiledGrammar> grammar);
+
+    const std::shared_ptr<const CompiledGrammar>& grammar() const
+        { return p_grammar; }
+
+    /** Number of workers, 0 for QThread::idealThreadCount() */
+    int numThreads() const { return p_numThreads; }
+    void setNumThreads(int n) { p_numThreads = n; }
+    /** Sets the function for Parsers of workers not started yet */
+    void setInit(InitFunc f) { p_init = f; }
+
+    /** Parses every text of @p inputs and calls @p done for each,
+        returns when all are parsed */
+    void parseEach(const QStringList& inputs, DoneFunc done);
+
+    /** Parses every text of @p inputs and returns the
+        @p result(Parser&, int worker) of each, in input order */
+    template <class Result, class F>
+    std::vector<Result> parseMany(const QStringList& inputs, F result)
+    {
+        std::vector<Result> r(inputs.size());
+        parseEach(inputs, [&](Parser& p, int worker, int index)
+        {
+            r[index] = result(p, worker);
+        });
+        return r;
+    }
+
+    // ---- throughput of the last batch ----
+
+    int numDocuments() const { return p_numDocs; }
+    qint64 numChars() const { return p_numChars; }
+    qint64 nsecsElapsed() const { return p_nsecs; }
+    double documentsPerSecond() const
+        { return p_nsecs ? p_numDocs * 1e9 / p_nsecs : 0.; }
+    /** Texts parsed by each worker */
+    const std::vector<int>& documentsPerWorker() const
+        { return p_docsPerWorker; }
+
+private:
+    std::shared_ptr<const CompiledGrammar> p_grammar;
+    int p_numThreads;
+    InitFunc p_init;
+    std::vector<std::unique_ptr<Parser>> p_parsers;
+
+    int p_numDocs;
+    qint64 p_numChars, p_nsecs;
+    std::vector<int> p_docsPerWorker;
+};
+
+#endif // PARSEPOOL_H
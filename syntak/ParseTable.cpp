@@ -0,0 +1,267 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <map>
+#include <algorithm>
+
+#include "ParseTable.h"
+#include "GrammarData.h"
+
+ParseTable::ParseTable(const Rules& rules)
+    : p_numTerminals(1)
+{
+    while (p_numTerminals < rules.numIds()
+           && rules.rule(p_numTerminals)->type() == Rule::T_TOKEN)
+        ++p_numTerminals;
+
+    p_computeFollow(rules);
+
+    p_table.assign(rules.numIds() * p_numTerminals, -1);
+    for (int id=p_numTerminals; id<rules.numIds(); ++id)
+    {
+        const Rule* r = rules.rule(id);
+        if (r->type() == Rule::T_OR)
+            p_checkOr(rules, r);
+        else if (r->type() == Rule::T_OPERATORS)
+            p_checkOperators(rules, r);
+        else
+            p_checkAnd(rules, r);
+    }
+}
+
+std::vector<bool> ParseTable::p_followAfter(const Rule* r, int idx) const
+{
+    std::vector<bool> f(p_numTerminals, false);
+    for (int i=idx+1; i<int(r->subRules().size()); ++i)
+    {
+        const Rule::SubRule& sub = r->subRules()[i];
+        for (int t=1; t<p_numTerminals; ++t)
+            if (sub.rule->canStartWith(t))
+                f[t] = true;
+        if (!sub.isOptional && !sub.rule->isNullable())
+            return f;
+    }
+    for (int t=1; t<p_numTerminals; ++t)
+        if (p_follow[r->id()][t])
+            f[t] = true;
+    return f;
+}
+
+bool ParseTable::isValidFor(const Rules& rules) const
+{
+    if (int(p_follow.size()) != rules.numIds()
+            || p_numTerminals > rules.numIds())
+        return false;
+    for (int id=1; id<rules.numIds(); ++id)
+        if ((rules.rule(id)->type() == Rule::T_TOKEN) != (id < p_numTerminals))
+            return false;
+    for (int id=p_numTerminals; id<rules.numIds(); ++id)
+        for (int t=0; t<p_numTerminals; ++t)
+        {
+            const int alt = p_table[id * p_numTerminals + t];
+            if (alt >= int(rules.rule(id)->subRules().size()))
+                return false;
+        }
+    return true;
+}
+
+bool ParseTable::canFollow(const Rule* r, int idx, int id) const
+{
+    for (int i=idx+1; i<int(r->subRules().size()); ++i)
+    {
+        const Rule::SubRule& sub = r->subRules()[i];
+        if (sub.rule->canStartWith(id))
+            return true;
+        if (!sub.isOptional && !sub.rule->isNullable())
+            return false;
+    }
+    return canFollow(r, id);
+}
+
+void ParseTable::p_computeFollow(const Rules& rules)
+{
+    p_follow.assign(rules.numIds(), std::vector<bool>(p_numTerminals, false));
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int id=p_numTerminals; id<rules.numIds(); ++id)
+        {
+            const Rule* r = rules.rule(id);
+            for (int idx=0; idx<int(r->subRules().size()); ++idx)
+            {
+                const Rule::SubRule& sub = r->subRules()[idx];
+                std::vector<bool> f = r->type() == Rule::T_OR
+                        ? p_follow[id] : p_followAfter(r, idx);
+                if (sub.isRecursive)
+                    for (int t=1; t<p_numTerminals; ++t)
+                        if (sub.rule->canStartWith(t))
+                            f[t] = true;
+                // operands are followed by binary operators
+                for (const Operator& o : r->operators())
+                    if (!o.isPrefix())
+                        f[o.tokenId()] = true;
+
+                std::vector<bool>& follow = p_follow[sub.rule->id()];
+                for (int t=1; t<p_numTerminals; ++t)
+                    if (f[t] && !follow[t])
+                        follow[t] = changed = true;
+            }
+        }
+    }
+}
+
+void ParseTable::p_checkOr(const Rules& rules, const Rule* r)
+{
+    // first alternative per terminal, collect the ones shadowed
+    std::map<std::pair<int, int>, std::vector<bool>> clashes;
+    for (int t=0; t<p_numTerminals; ++t)
+    {
+        const std::vector<int>& alts = r->alternatives(t);
+        if (alts.empty())
+            continue;
+        p_table[r->id() * p_numTerminals + t] = alts.front();
+        for (size_t i=1; i<alts.size(); ++i)
+        {
+            auto& c = clashes[std::make_pair(alts.front(), alts[i])];
+            c.resize(p_numTerminals, false);
+            c[t] = true;
+        }
+    }
+
+    for (auto& c : clashes)
+    {
+        const QString a = r->subRules()[c.first.first].name,
+                      b = r->subRules()[c.first.second].name;
+        if (c.second[0])
+            p_conflicts << QString("%1: alternatives %2 and %3 "
+                                   "can both be empty")
+                           .arg(r->name()).arg(a).arg(b);
+        c.second[0] = false;
+        if (std::find(c.second.begin(), c.second.end(), true)
+                != c.second.end())
+            p_conflicts << QString("%1: alternatives %2 and %3 "
+                                   "both fit %4")
+                           .arg(r->name()).arg(a).arg(b)
+                           .arg(p_names(rules, c.second));
+    }
+}
+
+void ParseTable::p_checkAnd(const Rules& rules, const Rule* r)
+{
+    for (int idx=0; idx<int(r->subRules().size()); ++idx)
+    {
+        const Rule::SubRule& sub = r->subRules()[idx];
+        if (!sub.isOptional && !sub.isRecursive)
+            continue;
+
+        QString name = sub.isOptional ? "[" + sub.name + "]" : sub.name;
+        if (sub.isRecursive)
+            name += "*";
+
+        if (sub.isRecursive && sub.rule->isNullable())
+        {
+            p_conflicts << QString("%1: %2 repeats a rule that can be empty")
+                           .arg(r->name()).arg(name);
+            continue;
+        }
+        // entering a nullable rule never decides anything
+        if (sub.rule->isNullable())
+            continue;
+
+        std::vector<bool> overlap = p_followAfter(r, idx);
+        bool any = false;
+        for (int t=1; t<p_numTerminals; ++t)
+        {
+            overlap[t] = overlap[t] && sub.rule->canStartWith(t);
+            any |= overlap[t];
+        }
+        if (any)
+            p_conflicts << QString("%1: %2 and what follows both start "
+                                   "with %3")
+                           .arg(r->name()).arg(name)
+                           .arg(p_names(rules, overlap));
+    }
+}
+
+void ParseTable::p_checkOperators(const Rules& rules, const Rule* r)
+{
+    // another operand or the end of the rule
+    std::vector<bool> binary(p_numTerminals, false), prefix = binary;
+    bool anyBinary = false, anyPrefix = false;
+    for (const Operator& o : r->operators())
+    {
+        const int t = o.tokenId();
+        if (o.isPrefix())
+            anyPrefix |= prefix[t] = r->subRules()[0].rule->canStartWith(t);
+        else
+            anyBinary |= binary[t] = p_follow[r->id()][t];
+    }
+    if (anyBinary)
+        p_conflicts << QString("%1: operators %2 can also follow %1")
+                       .arg(r->name()).arg(p_names(rules, binary));
+    if (anyPrefix)
+        p_conflicts << QString("%1: prefix operators %2 can also start %3")
+                       .arg(r->name()).arg(p_names(rules, prefix))
+                       .arg(r->subRules()[0].name);
+}
+
+QString ParseTable::p_names(const Rules& rules,
+                            const std::vector<bool>& ids) const
+{
+    QStringList names;
+    for (int t=1; t<p_numTerminals; ++t)
+        if (ids[t])
+            names << rules.rule(t)->name();
+    return names.join(", ");
+}
+
+
+QDataStream& operator << (QDataStream& s, const ParseTable& t)
+{
+    s << qint32(t.p_numTerminals);
+    GrammarData::write(s, t.p_follow);
+    GrammarData::write(s, t.p_table);
+    GrammarData::write(s, t.p_conflicts);
+    return s;
+}
+
+QDataStream& operator >> (QDataStream& s, ParseTable& t)
+{
+    qint32 n;
+    s >> n;
+    t.p_numTerminals = n;
+    if (GrammarData::read(s, t.p_follow)
+            && GrammarData::read(s, t.p_table)
+            && GrammarData::read(s, t.p_conflicts)
+            && (n < 1 || t.p_table.size() != t.p_follow.size() * n))
+        s.setStatus(QDataStream::ReadCorruptData);
+    for (const auto& f : t.p_follow)
+        if (int(f.size()) != n)
+            s.setStatus(QDataStream::ReadCorruptData);
+    return s;
+}
@@ -0,0 +1,102 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef PARSETABLE_H
+#define PARSETABLE_H
+
+#include <vector>
+
+#include <QString>
+#include <QStringList>
+
+#include "Rules.h"
+
+/** LL(1) parse table of a checked Rules set.
+
+    Holds the alternative of every T_OR rule per terminal symbol,
+    used by Parser::E_TABLE to parse without backtracking.
+    Optional and repeated subrules are entered when the lookahead is
+    in their FIRST set, or when they are nullable.
+
+    The grammar is LL(1) when none of these decisions can be wrong
+    for input the grammar derives; then the table engine calls the
+    same callbacks in the same order as the backtracking engine.
+    Otherwise conflicts() names the rules that need more lookahead. */
+class ParseTable
+{
+public:
+    explicit ParseTable(const Rules& rules);
+    /** Without rules, for reading with operator >> */
+    ParseTable() : p_numTerminals(1) { }
+
+    bool isLL1() const { return p_conflicts.isEmpty(); }
+    /** One description per ambiguous decision */
+    const QStringList& conflicts() const { return p_conflicts; }
+
+    /** Index of the subrule of T_OR rule @p r to parse
+        for terminal symbol @p id, or -1 */
+    int alternative(const Rule* r, int id) const
+    {
+        if (id <= 0 || id >= p_numTerminals)
+            id = 0;
+        return p_table[r->id() * p_numTerminals + id];
+    }
+
+    /** The table was built for @p rules, false for
+        corrupt data read with operator >> */
+    bool isValidFor(const Rules& rules) const;
+
+    /** FOLLOW set, terminal symbols that can follow rule @p r */
+    bool canFollow(const Rule* r, int id) const
+        { return id > 0 && id < p_numTerminals
+                 && p_follow[r->id()][id]; }
+    /** Terminal symbol @p id can follow subrule @p idx
+        of T_AND rule @p r */
+    bool canFollow(const Rule* r, int idx, int id) const;
+
+private:
+    friend QDataStream& operator << (QDataStream&, const ParseTable&);
+    friend QDataStream& operator >> (QDataStream&, ParseTable&);
+
+    void p_computeFollow(const Rules& rules);
+    void p_checkOr(const Rules& rules, const Rule* r);
+    void p_checkAnd(const Rules& rules, const Rule* r);
+    void p_checkOperators(const Rules& rules, const Rule* r);
+    /** Terminals that can follow subrule @p idx of T_AND rule @p r */
+    std::vector<bool> p_followAfter(const Rule* r, int idx) const;
+    QString p_names(const Rules& rules, const std::vector<bool>& ids) const;
+
+    int p_numTerminals;
+    std::vector<std::vector<bool>> p_follow;
+    /** T_OR alternative per rule id * p_numTerminals + terminal */
+    std::vector<qint16> p_table;
+    QStringList p_conflicts;
+};
+
+QDataStream& operator << (QDataStream& s, const ParseTable& t);
+QDataStream& operator >> (QDataStream& s, ParseTable& t);
+
+#endif // PARSETABLE_H
@@ -27,26 +27,98 @@ SOFTWARE.
 #include "Parser.h"
 
 Parser::Parser()
+    : Parser(CompiledGrammar::create(Tokens(), Rules()))
 {
+}
 
+Parser::Parser(std::shared_ptr<const CompiledGrammar> grammar)
+    : p_grammar     (grammar)
+    , p_engine      (E_BACKTRACKING)
+    , p_usedEngine  (E_BACKTRACKING)
+    , p_lexxerThreads(-1)
+    , p_lookId      (-1)
+    , p_furthest    (0)
+    , p_packrat     (false)
+    , p_memoize     (false)
+    , p_memoHits    (0)
+    , p_defer       (false)
+    , p_deferring   (false)
+    , p_discarded   (0)
+    , p_buildTree   (false)
+    , p_incremental (false)
+    , p_reused      (0)
+    , p_memoTree    (false)
+{
+    p_reuse.active = false;
 }
 
-namespace
+void Parser::setGrammar(std::shared_ptr<const CompiledGrammar> grammar)
+{
+    p_grammar = grammar;
+    // rule ids may differ
+    p_memo.clear();
+    p_funcs.clear();
+    p_subFuncs.clear();
+    for (const Connection& c : p_connections)
+        p_connect(c);
+}
+
+bool Parser::connect(const QString& name, Rule::Callback f)
+{
+    return connect(name, -1, f);
+}
+
+bool Parser::connect(const QString& name, int idx, Rule::Callback f)
 {
-    class LevelInc
+    Connection c;
+    c.name = name;
+    c.idx = idx;
+    c.func = f;
+    // memoized emits point to the callbacks
+    p_memo.clear();
+    if (!p_connect(c))
     {
-    public:
-        LevelInc(int* lev) : l(lev)
-            { ++(*l); if (*l>100) { PARSE_ERROR("TOO NESTED"); } }
-        ~LevelInc() { --(*l); }
-        int* l;
-    };
+        qWarning() << "rule " << name << " has no subrule " << idx;
+        return false;
+    }
+
+    for (Connection& old : p_connections)
+        if (old.name == name && old.idx == idx)
+        {
+            old.func = f;
+            return true;
+        }
+    p_connections.push_back(c);
+    return true;
+}
 
+bool Parser::p_connect(const Connection& c)
+{
+    const int id = rules().id(c.name);
+    if (id < 0 || c.idx >= int(rules().rule(id)->subRules().size()))
+        return false;
+    if (c.idx < 0)
+    {
+        if (size_t(id) >= p_funcs.size())
+            p_funcs.resize(rules().numIds());
+        p_funcs[id] = c.func;
+        return true;
+    }
+    if (size_t(id) >= p_subFuncs.size())
+        p_subFuncs.resize(rules().numIds());
+    p_subFuncs[id].resize(rules().rule(id)->subRules().size());
+    p_subFuncs[id][c.idx] = c.func;
+    return true;
+}
+
+namespace
+{
 #if 0
 #   define P_DEBUG(arg__) \
-        { QString indent__ = p_level ? QString("%1").arg(p_level) \
+        { const int level__ = p_frames.size(); \
+      QString indent__ = level__ ? QString("%1").arg(level__) \
                                  : QString(" "); \
-      indent__ += QString(" ").repeated(p_level+1 - indent__.size()); \
+      indent__ += QString(" ").repeated(level__+1 - indent__.size()); \
       qDebug().noquote().nospace() << indent__ << arg__; }
 #else
 #   define P_DEBUG(unused__) { }
@@ -55,12 +127,27 @@ namespace
 
 bool Parser::forward()
 {
-    if (++p_lookPos >= p_tokens.size())
+    if (!p_hasToken(++p_lookPos))
     {
         p_look = LexxedToken();
+        p_lookId = -1;
         return false;
     }
-    p_look = p_tokens[p_lookPos];
+    p_look = p_token(p_lookPos);
+    p_lookId = p_grammar->symbolOf(p_look.kind());
+    if (p_lookPos > p_furthest)
+    {
+        p_furthest = p_lookPos;
+        p_furthestToken = p_look;
+    }
+
+    if (p_stream)
+    {
+        size_t keep = p_pins.empty() ? p_lookPos : p_pins.front();
+        for (auto p : p_posStack)
+            keep = std::min(keep, p);
+        p_stream->release(keep);
+    }
     return true;
 }
 
@@ -76,141 +163,891 @@ void Parser::popPos()
 void Parser::setPos(size_t p)
 {
     p_lookPos = p;
-    p_look = p_lookPos < p_tokens.size() ? p_tokens[p_lookPos]
-                                         : LexxedToken();
+    p_look = p_hasToken(p_lookPos) ? p_token(p_lookPos)
+                                   : LexxedToken();
+    p_lookId = p_look.isValid() ? p_grammar->symbolOf(p_look.kind()) : -1;
+}
+
+const ParseResult& Parser::parse(const QString &text)
+{
+    p_stream.reset();
+    p_utf8 = Utf8Input();
+    p_tokens.clear();
+    p_text = text;
+    lexxer().tokenize(p_text, p_tokens, p_lexxerThreads < 0
+                      ? lexxer().numThreads() : p_lexxerThreads);
+
+    P_DEBUG("LEXXED: " << lexxer().toString(p_text, p_tokens));
+
+    return p_parse();
+}
+
+const ParseResult& Parser::parse(const QString& text, const TextEdit& edit)
+{
+    if (p_stream || !p_utf8.isEmpty() || p_tokens.empty())
+        return parse(text);
+
+    const int oldSize = p_tokens.size();
+    int first;
+    const int numNew = lexxer().relex(text, p_tokens, edit, &first);
+    p_reuse.active = p_incremental;
+    p_reuse.first = first;
+    p_reuse.numNew = numNew;
+    p_reuse.tokenShift = int(p_tokens.size()) - oldSize;
+    p_reuse.charShift = edit.delta();
+    p_reuse.lineShift = 0;
+    for (int i = 0; i < edit.inserted(); ++i)
+        if (text[edit.offset() + i] == '\n')
+            ++p_reuse.lineShift;
+    for (int i = 0; i < edit.removed(); ++i)
+        if (p_text[edit.offset() + i] == '\n')
+            --p_reuse.lineShift;
+    p_text = text;
+
+    P_DEBUG("RELEXXED: " << lexxer().toString(p_text, p_tokens));
+
+    return p_parse();
 }
 
-void Parser::parse(const QString &text)
+const ParseResult& Parser::parse(const Utf8Input& input)
 {
+    p_stream.reset();
+    p_text.clear();
     p_tokens.clear();
+    p_utf8 = input;
+    lexxer().tokenize(p_utf8, p_tokens);
+    return p_parse();
+}
+
+const ParseResult& Parser::parse(QIODevice* device)
+{
+    p_utf8 = Utf8Input();
+    p_tokens.clear();
+    p_text.clear();
+    p_stream = std::make_shared<TokenStream>(lexxer(), device);
+    return p_parse();
+}
+
+const ParseResult& Parser::parse(TokenStream::ChunkFunc nextChunk)
+{
+    p_utf8 = Utf8Input();
+    p_tokens.clear();
+    p_text.clear();
+    p_stream = std::make_shared<TokenStream>(lexxer(), nextChunk);
+    return p_parse();
+}
+
+const ParseResult& Parser::p_parse()
+{
     p_lookPos = 0;
-    p_level = 0;
+    p_frames.clear();
+    p_ops.clear();
     p_visited = 0;
-    p_text = text;
-    p_lexxer.tokenize(p_text, p_tokens);
+    p_memoHits = 0;
+    p_pins.clear();
+    p_memoize = (p_packrat || p_incremental) && !p_stream;
+    // the last results are kept for the edit, if they have nodes
+    // when a tree is built
+    p_reuse.active &= p_memoize && (p_memoTree || !p_buildTree);
+    p_reused = 0;
+    if (p_reuse.active)
+    {
+        p_memo.swap(p_prevMemo);
+        p_emits.swap(p_prevEmits);
+        std::swap(p_tree, p_prevTree);
+    }
+    p_memo.clear();
+    p_emits.clear();
+    p_log.clear();
+    p_discarded = 0;
+    p_tree.clear();
+    p_memoTree = p_buildTree;
+    // memoized results are copied from nodes of failed rules
+    p_tree.p_keep = p_memoize;
+    p_result.p_matched = false;
+    p_result.p_diagnostics.clear();
     setPos(0);
+    p_furthest = 0;
+    p_furthestToken = curToken();
 
-    P_DEBUG("LEXXED: " p_lexxer.toString(p_tokens));
+    if (!rules().topRule())
+    {
+        p_reuse.active = false;
+        for (const QString& e : rules().errors())
+            p_result.p_diagnostics.push_back(ParseDiagnostic(SourcePos(), e));
+        if (p_result.p_diagnostics.empty())
+            p_result.p_diagnostics.push_back(
+                        ParseDiagnostic(SourcePos(), "No top-level rule defined"));
+        return p_result;
+    }
 
+    p_usedEngine = p_engine == E_TABLE && parseTable().isLL1()
+            ? E_TABLE : E_BACKTRACKING;
+    p_deferring = p_defer && !p_stream && p_usedEngine == E_BACKTRACKING;
+    if (p_usedEngine == E_TABLE)
+        p_result.p_matched = p_parseTable();
+    else
+        p_result.p_matched = parseRule(rules().topRule());
 
-    if (!p_rules.topRule())
-        PARSE_ERROR("No top-level rule defined");
+    if (!p_result.p_matched)
+        p_unexpected(rules().topRule()->name());
+    else
+    {
+        if (curToken().isValid() && curSymbol() != Rules::ID_EOF)
+            p_unexpected(QString());
+        p_dispatchLog();
+    }
+    // positions would overflow behind the limit
+    if (p_stream && p_stream->isTruncated())
+        p_result.p_diagnostics.push_back(ParseDiagnostic(
+                SourcePos(p_stream->textEnd(), p_furthestToken.pos().line()),
+                QString("Input longer than %1 characters")
+                    .arg(p_stream->textLimit())));
+    p_reuse.active = false;
+    return p_result;
+}
 
-    if (!parseRule(p_rules.topRule()))
-        PARSE_ERROR("No top statement found");
+void Parser::p_unexpected(const QString& context)
+{
+    // the table engine stops at the error,
+    // backtracking may have looked further
+    const LexxedToken t = p_furthest > p_lookPos ? p_furthestToken
+                                                 : curToken();
+    QString msg = QString("Unexpected %1")
+            .arg(t.isValid() ? lexxer().name(t.kind()) : QString("end"));
+    if (!context.isEmpty())
+        msg += " in " + context;
+    p_result.p_diagnostics.push_back(ParseDiagnostic(t.pos(), msg));
+}
+
+void Parser::p_recover(const Rule* r, int idx)
+{
+    const Rule* sub = r->subRules()[idx].rule;
+    const size_t begin = p_lookPos, furthest = p_furthest;
+    const LexxedToken first = curToken(),
+            failed = furthest > begin ? p_furthestToken : first;
+
+    while (curToken().isValid() && curSymbol() != Rules::ID_EOF
+           && !sub->isSyncToken(curSymbol()))
+        forward();
+    if (curToken().isValid() && curSymbol() != Rules::ID_EOF)
+        forward();
+
+    // report where the rule got stuck, if that was skipped
+    const LexxedToken& t = furthest < p_lookPos ? failed : first;
+    p_result.p_diagnostics.push_back(ParseDiagnostic(
+            t.pos(), QString("Unexpected %1 in %2")
+                     .arg(lexxer().name(t.kind())).arg(sub->name()),
+            begin, p_lookPos));
+    P_DEBUG("RECOVER " << p_result.p_diagnostics.back().toString());
+
+    p_furthest = p_lookPos;
+    p_furthestToken = curToken();
+    // results of the open rules now include a diagnostic
+    for (Frame& f : p_frames)
+        f.emitBegin = -1;
+}
+
+bool Parser::p_parseTable()
+{
+    // reused between parses
+    std::vector<TableFrame>& stack = p_tableFrames;
+    stack.clear();
+
+    // Starts rule @p r, returns false if it can not match.
+    // Tokens are matched right away.
+    auto call = [this, &stack](const Rule* r, const Rule* parent, int subIdx)
+    {
+        if (!curToken().isValid() || curSymbol() == Rules::ID_EOF)
+            return false;
+        if (!r->isNullable() && !r->canStartWith(curSymbol()))
+            return false;
+        ++p_visited;
+
+        const SourcePos from = curToken().pos();
+        if (r->type() == Rule::T_TOKEN)
+        {
+            if (p_buildTree)
+                p_tree.p_leaf(r->id(), p_lookPos);
+            forward();
+            p_emitRule(r, parent, subIdx, from);
+            return true;
+        }
+
+        TableFrame f;
+        f.rule = r;
+        f.parent = parent;
+        f.subIdx = subIdx;
+        f.idx = r->type() == Rule::T_AND ? 0 : -1;
+        f.again = false;
+        f.pinned = p_callback(r)
+                || (parent && p_callback(parent, subIdx));
+        f.from = from;
+        if (f.pinned)
+            p_pin(p_lookPos);
+        if (p_buildTree)
+            p_tree.p_open(r->id(), p_lookPos);
+        stack.push_back(f);
+        return true;
+    };
+
+    if (!call(rules().topRule(), nullptr, -1))
+        return false;
+
+    while (!stack.empty())
+    {
+        TableFrame& f = stack.back();
+        const Rule* r = f.rule;
+        if (r->type() == Rule::T_OR)
+        {
+            if (f.idx < 0)
+            {
+                f.idx = parseTable().alternative(r, curSymbol());
+                if (f.idx < 0
+                        || !call(r->subRules()[f.idx].rule, r, f.idx))
+                    return false;
+                continue;
+            }
+        }
+        else if (r->type() == Rule::T_OPERATORS)
+        {
+            // idx is the size of p_ops at start
+            bool operand = f.idx < 0;
+            if (operand)
+                f.idx = p_ops.size();
+            else
+            {
+                const Operator* o = r->binaryOperator(curSymbol());
+                p_reduceOps(f.idx, o);
+                if (o)
+                {
+                    p_pushOp(o);
+                    operand = true;
+                }
+            }
+            if (operand)
+            {
+                while (const Operator* o = r->prefixOperator(curSymbol()))
+                    p_pushOp(o);
+                if (!call(r->subRules()[0].rule, r, 0))
+                    return false;
+                continue;
+            }
+        }
+        else if (f.idx < int(r->subRules().size()))
+        {
+            const int idx = f.idx;
+            const Rule::SubRule& sub = r->subRules()[idx];
+            if ((sub.isOptional || f.again) && !p_canEnter(sub.rule))
+            {
+                f.again = false;
+                ++f.idx;
+                continue;
+            }
+            if (sub.isRecursive)
+                f.again = true;
+            else
+                ++f.idx;
+            if (!call(sub.rule, r, idx))
+                return false;
+            continue;
+        }
+
+        const TableFrame done = f;
+        stack.pop_back();
+        p_emitRule(done.rule, done.parent, done.subIdx, done.from);
+        if (p_buildTree)
+            p_tree.p_close(p_lookPos);
+        if (done.pinned)
+            p_unpin();
+    }
+    return true;
 }
 
 bool Parser::parseRule(const Rule* r, const Rule* parent, int subIdx)
 {
-    if (!curToken().isValid() || curToken().name() == "EOF")
+    const size_t base = p_frames.size();
+    bool ret;
+    if (!p_enter(r, parent, subIdx, &ret))
+        return ret;
+
+    // run until the frame of r is finished
+    while (p_frames.size() > base)
+    {
+        const size_t fi = p_frames.size() - 1;
+        bool pushed;
+        switch (p_frames[fi].rule->type())
+        {
+            case Rule::T_OR: pushed = p_stepOr(fi, &ret); break;
+            case Rule::T_OPERATORS: pushed = p_stepOperators(fi, &ret); break;
+            default: pushed = p_stepAnd(fi, &ret); break;
+        }
+        if (!pushed)
+        {
+            const Frame f = p_frames.back();
+            p_frames.pop_back();
+            p_finish(f, ret);
+        }
+    }
+    return ret;
+}
+
+bool Parser::p_enter(const Rule* r, const Rule* parent, int subIdx,
+                     bool* ret)
+{
+    *ret = false;
+    if (!p_frames.empty())
+        p_frames.back().examined = std::max(p_frames.back().examined,
+                                            qint32(p_lookPos));
+    if (!curToken().isValid() || curSymbol() == Rules::ID_EOF)
+        return false;
+    // the lookahead can not start the rule
+    if (!r->isNullable() && !r->canStartWith(curSymbol()))
         return false;
 
-    LevelInc linc(&p_level);
     P_DEBUG(r->toString() << " ("
             << "\t\"" << p_text.mid(curToken().pos().pos()) << "\""
             << " " << subIdx
             );
-    auto oldPos = curToken().pos();
-    bool ret = parseRule_(r);
-    P_DEBUG(") " << r->toString() << " =" << ret
-            //<< "\t\"" << p_text.mid(curToken().pos().pos()) << "\""
-            );
 
-    // emit subrules
-    if (ret && parent && subIdx >= 0 && subIdx < parent->subRules().size()
-        && parent->subRules()[subIdx].func)
+    Frame f;
+    f.rule = r;
+    f.parent = parent && subIdx >= 0
+               && subIdx < int(parent->subRules().size())
+               && p_callback(parent, subIdx) ? parent : nullptr;
+    f.from = curToken().pos();
+    f.start = f.pos = p_lookPos;
+    f.idx = 0;
+    f.emitBegin = -1;
+    f.subIdx = subIdx;
+    f.logBegin = p_log.size();
+    f.diagBegin = p_result.p_diagnostics.size();
+    f.node = -1;
+    f.examined = p_lookPos;
+    f.state = S_START;
+    f.emits = f.parent || p_callback(r);
+    if (f.emits)
+        p_pin(p_lookPos);
+
+    // the FIRST set check already compared the token
+    if (r->type() == Rule::T_TOKEN)
     {
-        int curPos = curToken().isValid() ? curToken().pos().pos()
-                                          : p_text.size();
-        while (curPos-1 < p_text.size()
-               && curPos > oldPos.pos() && p_text[curPos-1].isSpace())
-            --curPos;
+        if (p_buildTree)
+            p_tree.p_leaf(r->id(), p_lookPos);
+        forward();
+        *ret = true;
+        p_finish(f, true);
+        return false;
+    }
 
-        ParsedToken t;
-        t.p_pos = oldPos;
-        t.p_text = p_text.mid(oldPos.pos(), curPos - oldPos.pos());
-        t.p_rule = parent->subRules()[subIdx].rule;
-        parent->subRules()[subIdx].func(t);
+    if (p_memoize)
+    {
+        auto it = p_memo.find(p_memoKey(f));
+        if (it != p_memo.end())
+        {
+            ++p_memoHits;
+            const Memo m = it->second;
+            for (int i = m.emitBegin; i < m.emitEnd; ++i)
+            {
+                // replays are recorded again for enclosing rules
+                const Emit e = p_emits[i];
+                p_emits.push_back(e);
+                p_call(*e.func, e.rule, e.from, e.to);
+            }
+            if (m.end >= 0)
+            {
+                setPos(m.end);
+                if (p_buildTree)
+                    p_tree.p_copy(m.nodeBegin, m.nodeEnd);
+            }
+            f.examined = m.examined;
+            *ret = m.end >= 0;
+            p_finish(f, *ret);
+            return false;
+        }
+        if (p_reuse.active && p_reuseMemo(f, ret))
+            return false;
+        f.emitBegin = p_emits.size();
     }
+    if (p_buildTree)
+        f.node = p_tree.p_open(r->id(), p_lookPos);
 
-    // emit rule
-    if (ret && r->p_func)
+    p_frames.push_back(f);
+    return true;
+}
+
+void Parser::p_finish(const Frame& f, bool ret)
+{
+    P_DEBUG(") " << f.rule->toString() << " =" << ret);
+
+    // the parent may look at the token after the rule
+    const qint32 examined = std::max(f.examined, qint32(p_lookPos));
+    if (!p_frames.empty())
+        p_frames.back().examined = std::max(p_frames.back().examined,
+                                            examined);
+
+    if (f.emitBegin >= 0)
     {
-        int curPos = curToken().isValid() ? curToken().pos().pos()
-                                          : p_text.size();
-        while (curPos-1 < p_text.size()
-               && curPos > oldPos.pos() && p_text[curPos-1].isSpace())
-            --curPos;
+        Memo m;
+        m.end = ret ? qint32(p_lookPos) : -1;
+        m.emitBegin = f.emitBegin;
+        m.emitEnd = p_emits.size();
+        m.nodeBegin = f.node;
+        m.nodeEnd = p_tree.size();
+        m.examined = examined;
+        p_memo[p_memoKey(f)] = m;
+    }
+
+    if (!ret && p_log.size() > size_t(f.logBegin))
+    {
+        p_discarded += p_log.size() - f.logBegin;
+        p_log.resize(f.logBegin);
+    }
+    // recovered errors of a failed path
+    if (!ret && p_result.p_diagnostics.size() > size_t(f.diagBegin))
+        p_result.p_diagnostics.erase(
+                    p_result.p_diagnostics.begin() + f.diagBegin,
+                    p_result.p_diagnostics.end());
 
-        ParsedToken t;
-        t.p_pos = oldPos;
-        t.p_text = p_text.mid(oldPos.pos(), curPos - oldPos.pos());
-        t.p_rule = r;
-        r->p_func(t);
+    if (f.node >= 0)
+    {
+        if (ret)
+            p_tree.p_close(p_lookPos);
+        else
+            p_tree.p_fail();
     }
+
+    if (ret)
+        p_emitRule(f.rule, f.parent, f.subIdx, f.from);
+
+    if (f.emits)
+        p_unpin();
     ++p_visited;
-    return ret;
 }
 
-bool Parser::parseRule_(const Rule* r)
+bool Parser::p_reuseMemo(const Frame& frame, bool* ret)
 {
-    switch (r->type())
+    const Reuse& u = p_reuse;
+    // results behind the edit moved, the ones before must not
+    // have looked at the edited tokens
+    const bool behind = frame.start >= u.first + u.numNew;
+    if (!behind && frame.start >= u.first)
+        return false;
+    const qint32 start = behind ? frame.start - u.tokenShift : frame.start;
+    auto it = p_prevMemo.find((quint64(start) << 32)
+                              | quint32(frame.rule->id()));
+    if (it == p_prevMemo.end()
+            || (!behind && it->second.examined >= u.first))
+        return false;
+    const Memo& old = it->second;
+    const qint32 shift = behind ? u.tokenShift : 0;
+    ++p_memoHits;
+    ++p_reused;
+
+    // becomes a result of this parse, for the next edit
+    Memo m;
+    m.end = old.end >= 0 ? old.end + shift : -1;
+    m.examined = old.examined + shift;
+    m.emitBegin = p_emits.size();
+    for (int i = old.emitBegin; i < old.emitEnd; ++i)
     {
-        case Rule::T_TOKEN:
-            if (curToken().name() != r->name())
-                return false;
-            forward();
-            return true;
+        Emit e = p_prevEmits[i];
+        if (behind)
+        {
+            e.from = SourcePos(e.from.pos() + u.charShift,
+                               e.from.line() + u.lineShift);
+            e.to += u.charShift;
+        }
+        p_emits.push_back(e);
+        p_call(*e.func, e.rule, e.from, e.to);
+    }
+    m.emitEnd = p_emits.size();
+    m.nodeBegin = m.nodeEnd = p_tree.size();
+    if (m.end >= 0)
+    {
+        setPos(m.end);
+        if (p_buildTree)
+        {
+            p_tree.p_copy(p_prevTree, old.nodeBegin, old.nodeEnd, shift);
+            m.nodeEnd = p_tree.size();
+        }
+    }
+    p_memo[p_memoKey(frame)] = m;
 
-        case Rule::T_AND:
+    Frame f = frame;
+    f.examined = m.examined;
+    *ret = m.end >= 0;
+    p_finish(f, *ret);
+    return true;
+}
+
+bool Parser::p_stepAnd(size_t fi, bool* ret)
+{
+    for (;;)
+    {
+        Frame& f = p_frames[fi];
+        const Rule* r = f.rule;
+        switch (f.state)
         {
-            auto backup = p_lookPos;
-            for (int idx=0; idx<r->subRules().size(); ++idx)
-            {
-                const Rule::SubRule& sub = r->subRules()[idx];
+            case S_START:
+                // can only go back to start until the last required subrule
+                if (r->p_lastRequired >= 0)
+                    p_pin(f.start);
+                f.idx = 0;
+                f.state = S_CALL;
+            break;
 
-                bool ret = parseRule(sub.rule, r, idx);
-                if (!sub.isOptional && ret == false)
+            case S_CALL:
+                if (f.idx >= int(r->subRules().size()))
                 {
-                    setPos(backup);
+                    *ret = true;
                     return false;
                 }
+                f.state = S_RESULT;
+                if (p_enter(r->subRules()[f.idx].rule, r, f.idx, ret))
+                    return true;
+            break;
 
-                if (sub.isRecursive && ret)
+            case S_RESULT:
+            {
+                const Rule::SubRule& sub = r->subRules()[f.idx];
+                if (!*ret && p_isError(r, f.idx, sub.isOptional))
                 {
-                    auto pos = p_lookPos;
-                    while (true)
+                    p_recover(r, f.idx);
+                    *ret = true;
+                }
+                if (!sub.isOptional && !*ret)
+                {
+                    setPos(f.start);
+                    p_unpin();
+                    return false;
+                }
+                f.state = S_NEXT;
+                if (sub.isRecursive && *ret)
+                {
+                    f.pos = p_lookPos;
+                    p_pin(f.pos);
+                    f.state = S_REPEAT;
+                    if (p_enter(sub.rule, r, f.idx, ret))
+                        return true;
+                }
+            }
+            break;
+
+            case S_REPEAT:
+                p_unpin();
+                if (!*ret)
+                {
+                    setPos(f.pos);
+                    if (!p_isError(r, f.idx, true))
                     {
-                        if (!parseRule(sub.rule, r, idx))
-                        {
-                            setPos(pos);
-                            break;
-                        }
-                        pos = p_lookPos;
+                        f.state = S_NEXT;
+                        break;
                     }
+                    p_recover(r, f.idx);
                 }
-            }
-            return true;
+                f.pos = p_lookPos;
+                p_pin(f.pos);
+                if (p_enter(r->subRules()[f.idx].rule, r, f.idx, ret))
+                    return true;
+            break;
+
+            case S_NEXT:
+                if (f.idx == r->p_lastRequired)
+                    p_unpin();
+                ++f.idx;
+                f.state = S_CALL;
+            break;
         }
-        break;
+    }
+}
 
-        case Rule::T_OR:
+bool Parser::p_stepOr(size_t fi, bool* ret)
+{
+    for (;;)
+    {
+        Frame& f = p_frames[fi];
+        const Rule* r = f.rule;
+        switch (f.state)
         {
-            auto pos = p_lookPos;
-            for (int idx=0; idx<r->subRules().size(); ++idx)
+            case S_START:
+                p_pin(f.start);
+                f.idx = 0;
+                f.state = S_CALL;
+            break;
+
+            case S_CALL:
             {
-                const Rule::SubRule& sub = r->subRules()[idx];
+                // alternatives for the token at start
+                setPos(f.start);
+                const std::vector<int>& alts = r->alternatives(curSymbol());
+                if (f.idx >= int(alts.size()))
+                {
+                    p_unpin();
+                    *ret = false;
+                    return false;
+                }
+                f.state = S_RESULT;
+                const int alt = alts[f.idx];
+                if (p_enter(r->subRules()[alt].rule, r, alt, ret))
+                    return true;
+            }
+            break;
+
+            case S_RESULT:
+                if (*ret)
+                {
+                    p_unpin();
+                    return false;
+                }
+                ++f.idx;
+                f.state = S_CALL;
+            break;
+
+            default:
+            break;
+        }
+    }
+}
+
+bool Parser::p_stepOperators(size_t fi, bool* ret)
+{
+    for (;;)
+    {
+        Frame& f = p_frames[fi];
+        const Rule* r = f.rule;
+        switch (f.state)
+        {
+            case S_START:
+                p_pin(f.start);
+                // pending operators of this rule start at pos
+                f.pos = p_ops.size();
+                f.state = S_CALL;
+            break;
 
-                setPos(pos);
-                bool ret = parseRule(sub.rule, r, idx);
-                if (ret)
+            case S_CALL:
+                while (const Operator* o = r->prefixOperator(curSymbol()))
+                    p_pushOp(o);
+                f.state = S_RESULT;
+                if (p_enter(r->subRules()[0].rule, r, 0, ret))
                     return true;
+            break;
+
+            case S_RESULT:
+            {
+                if (!*ret)
+                {
+                    // go back before the last binary operator, if any
+                    size_t i = p_ops.size();
+                    while (i > size_t(f.pos) && p_ops[i-1].op->isPrefix())
+                        --i;
+                    if (i == size_t(f.pos))
+                    {
+                        p_dropOps(f.pos);
+                        setPos(f.start);
+                        p_unpin();
+                        return false;
+                    }
+                    setPos(p_ops[i-1].pos);
+                    if (p_buildTree)
+                        p_tree.p_cut(p_ops[i-1].node);
+                    p_dropOps(i-1);
+                    p_reduceOps(f.pos, nullptr);
+                    p_unpin();
+                    *ret = true;
+                    return false;
+                }
+
+                const Operator* o = r->binaryOperator(curSymbol());
+                p_reduceOps(f.pos, o);
+                if (!o)
+                {
+                    p_unpin();
+                    return false;
+                }
+                p_pushOp(o);
+                f.state = S_CALL;
             }
-            setPos(pos);
-            return false;
+            break;
+
+            default:
+            break;
         }
-        break;
     }
+}
+
+void Parser::p_pushOp(const Operator* op)
+{
+    PendingOp p;
+    p.op = op;
+    p.from = curToken().pos();
+    p.pos = p_lookPos;
+    p.node = p_tree.size();
+    p_ops.push_back(p);
+    if (p_buildTree)
+        p_tree.p_leaf(op->tokenId(), p_lookPos);
+    // keep the text for the callback and the position to go back to
+    p_pin(p_lookPos);
+    forward();
+}
+
+void Parser::p_reduceOps(size_t base, const Operator* next)
+{
+    while (p_ops.size() > base
+           && (!next || p_ops.back().op->bindsBefore(*next)))
+    {
+        const PendingOp p = p_ops.back();
+        p_ops.pop_back();
+        const Rule* r = p.op->callRule();
+        if (const Rule::Callback* func = p_callback(r))
+            p_emit(*func, r, p.from, p_emitEnd(p.from));
+        p_unpin();
+    }
+}
+
+void Parser::p_dropOps(size_t base)
+{
+    while (p_ops.size() > base)
+    {
+        p_ops.pop_back();
+        p_unpin();
+    }
+}
+
+void Parser::p_emitRule(const Rule* r, const Rule* parent, int subIdx,
+                        const SourcePos& from)
+{
+    const Rule::Callback* sub = parent ? p_callback(parent, subIdx)
+                                       : nullptr,
+                        * func = p_callback(r);
+    if (!sub && !func)
+        return;
+    const int to = p_emitEnd(from);
+
+    // emit subrule
+    if (sub)
+        p_emit(*sub, parent->subRules()[subIdx].rule, from, to);
+
+    // emit rule
+    if (func)
+        p_emit(*func, r, from, to);
+}
+
+int Parser::p_emitEnd(const SourcePos& from) const
+{
+    int curPos = curToken().isValid() ? curToken().pos().pos()
+                                      : p_textEnd();
+    // strip trailing whitespace
+    while (curPos > from.pos())
+    {
+        int len = p_spaceBefore(curPos);
+        if (!len)
+            break;
+        curPos -= len;
+    }
+    return curPos;
+}
+
+void Parser::p_emit(const Rule::Callback& func, const Rule* r,
+                    const SourcePos& from, int to)
+{
+    if (p_memoize)
+    {
+        Emit e;
+        e.func = &func;
+        e.rule = r;
+        e.from = from;
+        e.to = to;
+        p_emits.push_back(e);
+    }
+    p_call(func, r, from, to);
+}
+
+void Parser::p_call(const Rule::Callback& func, const Rule* r,
+                    const SourcePos& from, int to)
+{
+    if (p_deferring)
+    {
+        Emit e;
+        e.func = &func;
+        e.rule = r;
+        e.from = from;
+        e.to = to;
+        p_log.push_back(e);
+        return;
+    }
+
+    ParsedToken t;
+    t.p_pos = from;
+    // shares a QString input, a copy of the text otherwise
+    if (p_stream || !p_utf8.isEmpty())
+    {
+        t.p_text = p_textMid(from.pos(), to - from.pos());
+        t.p_len = t.p_text.size();
+    }
+    else
+    {
+        t.p_text = p_text;
+        t.p_offset = from.pos();
+        t.p_len = to - from.pos();
+    }
+    t.p_rule = r;
+    func(t);
+}
+
+QString Parser::nodeText(int i) const
+{
+    const SyntaxTree::Node& n = p_tree.node(i);
+    if (p_stream || n.begin >= n.end)
+        return QString();
+    const int from = p_tokens[n.begin].pos().pos();
+    const LexxedToken& last = p_tokens[n.end - 1];
+    return p_textMid(from, last.pos().pos() + last.length() - from);
+}
+
+void Parser::p_dispatchLog()
+{
+    p_deferring = false;
+    for (const Emit& e : p_log)
+        p_call(*e.func, e.rule, e.from, e.to);
+    p_log.clear();
+}
+
+int Parser::p_textEnd() const
+{
+    if (p_stream)
+        return p_stream->textEnd();
+    if (!p_utf8.isEmpty())
+        return p_utf8.size();
+    return p_text.size();
+}
+
+QString Parser::p_textMid(int pos, int len) const
+{
+    if (p_stream)
+        return p_stream->mid(pos, len);
+    if (!p_utf8.isEmpty())
+        return p_utf8.text(pos, len);
+    return p_text.mid(pos, len);
+}
+
+int Parser::p_spaceBefore(int pos) const
+{
+    if (p_stream)
+        return p_stream->charAt(pos-1).isSpace() ? 1 : 0;
+    if (p_utf8.isEmpty())
+        return p_text[pos-1].isSpace() ? 1 : 0;
 
-    return false;
+    if (p_utf8.isAsciiSpace(pos-1))
+        return 1;
+    // find start of multi-byte sequence
+    int start = pos-1;
+    while (start > 0 && start > pos-4
+           && (p_utf8.data()[start] & 0xc0) == 0x80)
+        --start;
+    int end = start;
+    if (uchar(p_utf8.data()[start]) >= 0x80
+            && QChar::isSpace(p_utf8.decode(&end)) && end == pos)
+        return pos - start;
+    return 0;
 }
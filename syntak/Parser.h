@@ -27,56 +27,479 @@ SOFTWARE.
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <memory>
+#include <unordered_map>
+
 #include "Tokens.h"
+#include "TokenStream.h"
+#include "Utf8Input.h"
 #include "Rules.h"
+#include "ParseTable.h"
+#include "CompiledGrammar.h"
+#include "SyntaxTree.h"
 
 
+/** A syntax error found by Parser */
+class ParseDiagnostic
+{
+public:
+    ParseDiagnostic(const SourcePos& pos, const QString& message,
+                    int skipBegin = 0, int skipEnd = 0)
+        : p_pos(pos), p_message(message)
+        , p_skipBegin(skipBegin), p_skipEnd(skipEnd) { }
 
+    const SourcePos& pos() const { return p_pos; }
+    const QString& message() const { return p_message; }
+    /** Range of token indices skipped to recover, empty if the
+        parse did not go on */
+    int skipBegin() const { return p_skipBegin; }
+    int skipEnd() const { return p_skipEnd; }
 
+    QString toString() const
+        { return QString("%1: %2").arg(pos().toString()).arg(message()); }
+private:
+    SourcePos p_pos;
+    QString p_message;
+    int p_skipBegin, p_skipEnd;
+};
+
+/** Outcome of Parser::parse() */
+class ParseResult
+{
+public:
+    ParseResult() : p_matched(false) { }
+
+    /** The top rule matched all input without errors */
+    bool isOk() const { return p_matched && p_diagnostics.empty(); }
+    /** The top rule matched, possibly after recovering from
+        the errors in diagnostics(), see Rules::setSyncTokens() */
+    bool isMatched() const { return p_matched; }
+    const std::vector<ParseDiagnostic>& diagnostics() const
+        { return p_diagnostics; }
+
+    QString toString() const
+    {
+        QString s = isOk() ? "ok" : isMatched() ? "recovered" : "failed";
+        for (const ParseDiagnostic& d : p_diagnostics)
+            s += "\n" + d.toString();
+        return s;
+    }
+private:
+    friend class Parser;
+    bool p_matched;
+    std::vector<ParseDiagnostic> p_diagnostics;
+};
+
+
+/** Parses with a CompiledGrammar and holds the state of a parse.
+
+    Parsers in several threads can share one grammar, each Parser
+    must only be used by one thread at a time. */
 class Parser
 {
 public:
+
+    enum Engine
+    {
+        /** Recursive descent, trying alternatives in order */
+        E_BACKTRACKING,
+        /** Non-recursive LL(1) parser driven by a ParseTable,
+            E_BACKTRACKING is used when the rules are not LL(1) */
+        E_TABLE
+    };
+
     Parser();
+    explicit Parser(std::shared_ptr<const CompiledGrammar> grammar);
+
+    const std::shared_ptr<const CompiledGrammar>& grammar() const
+        { return p_grammar; }
+    /** Parses with @p grammar from now on,
+        the callbacks of connect() are kept by rule name */
+    void setGrammar(std::shared_ptr<const CompiledGrammar> grammar);
+
+    const Rules& rules() const { return p_grammar->rules(); }
+    const Tokens& lexxer() const { return p_grammar->lexxer(); }
+
+    /** Compiles a new grammar from @p r and lexxer() */
+    void setRules(const Rules& r)
+        { setGrammar(CompiledGrammar::create(lexxer(), r)); }
+    /** Compiles a new grammar from @p t and rules() */
+    void setLexxer(const Tokens& t)
+        { setGrammar(CompiledGrammar::create(t, rules())); }
+    void setLexxer(const Tokens& t, Tokens::Mode m)
+        { Tokens l(t); l.setMode(m); setLexxer(l); }
+
+    /** Threads that parse(const QString&) lexxes a large text with,
+        0 for QThread::idealThreadCount(), -1 for the
+        Tokens::numThreads() of the lexxer */
+    int lexxerThreads() const { return p_lexxerThreads; }
+    void setLexxerThreads(int n) { p_lexxerThreads = n; }
+
+    /** Calls @p f for rule @p name in this Parser only,
+        instead of the callback of the shared grammar.
+        Returns false if there is no such rule */
+    bool connect(const QString& name, Rule::Callback f);
+    /** Calls @p f for subrule @p idx of rule @p name in this Parser */
+    bool connect(const QString& name, int idx, Rule::Callback f);
+
+    /** Lexxes and parses @p text. Token, frame and log buffers of
+        the last parse are reused, so without packrat mode a parse of
+        no larger text does not allocate, apart from callbacks.
+        Syntax errors never abort, they end up in the result. */
+    const ParseResult& parse(const QString& text);
+    /** Parses @p text, which is the text of the last
+        parse(const QString&) changed by @p edit.
+        Only the tokens around the edit are lexxed again,
+        see Tokens::relex(). In incremental mode the results of the
+        last parse that did not look at the edited tokens are reused. */
+    const ParseResult& parse(const QString& text, const TextEdit& edit);
+    /** Parses UTF-8 text without converting it to QString,
+        positions in SourcePos are byte offsets.
+        Callbacks get the text converted as needed.
+        text() stays empty. */
+    const ParseResult& parse(const Utf8Input& input);
+    /** Parses UTF-8 text from @p device while lexxing it on demand.
+        Only the tokens and text the parser can still go back to,
+        or that a callback needs, are kept in memory.
+        text() and lexxedTokens() stay empty. Positions are int, input
+        behind TokenStream::textLimit() is cut off with a diagnostic. */
+    const ParseResult& parse(QIODevice* device);
+    const ParseResult& parse(TokenStream::ChunkFunc nextChunk);
+    /** Result of the last parse */
+    const ParseResult& result() const { return p_result; }
+
+    Engine engine() const { return p_engine; }
+    void setEngine(Engine e) { p_engine = e; }
+    /** The LL(1) table of the rules, see conflicts() */
+    const ParseTable& parseTable() const { return p_grammar->parseTable(); }
+    /** Engine that ran the last parse */
+    Engine usedEngine() const { return p_usedEngine; }
+
+    /** Memoizes the result of every rule at every token position,
+        so backtracking never parses a rule twice at the same position.
+        The callbacks emitted by a memoized rule are replayed,
+        they are called in the same order as without memoization.
+        Not used for parse(QIODevice*) and parse(ChunkFunc). */
+    void setPackrat(bool enable) { p_packrat = enable; }
+    bool isPackrat() const { return p_packrat; }
+
+    /** Memoizes like setPackrat() and keeps the memo of a parse for
+        the next parse(const QString&, const TextEdit&). Every result
+        remembers the last token it looked at. Results that looked
+        only at tokens before the edit, or that start behind it, are
+        taken over with shifted positions, their callbacks replayed,
+        so only the rules around the edit are parsed again.
+        Results that a reused one contains are not kept for the
+        following edit, an edit inside them parses the reused rule
+        again.
+
+        This saves the parsing, not the rest of the work per result:
+        every reused result still costs one memo lookup, a call of each
+        of its callbacks and a copy of its tree nodes, and relexing
+        moves all following tokens. A parse after an edit calls the
+        same callbacks as a full parse, so its cost stays linear in
+        the size of the text, only the rules around the edit are
+        entered. This is deliberately less than a reparse on the order
+        of the enclosing statement, which would need positions relative
+        to the parent and callbacks only for changed results.
+        See numReused(). */
+    void setIncremental(bool enable) { p_incremental = enable; }
+    bool isIncremental() const { return p_incremental; }
+    /** Number of results of the previous parse reused in the last,
+        each one a single lookup, not the rules it contains */
+    int numReused() const { return p_reused; }
 
-    const Rules& rules() const { return p_rules; }
-    const Tokens& lexxer() const { return p_lexxer; }
+    /** Collects the callbacks of the backtracking engine in a log,
+        entries of rules that fail are removed again while parsing.
+        The remaining callbacks are called after the parse succeeded,
+        in the same order, but without those of discarded paths.
+        The table engine never goes back and calls them right away,
+        as do parse(QIODevice*) and parse(ChunkFunc). */
+    void setDeferCallbacks(bool enable) { p_defer = enable; }
+    bool isDeferCallbacks() const { return p_defer; }
+    /** Number of callbacks dropped from the log in the last parse */
+    int numCallbacksDiscarded() const { return p_discarded; }
 
-    void setRules(const Rules& r) { p_rules = r; p_rules.check(); }
-    void setLexxer(const Tokens& t) { p_lexxer = t; }
+    /** Builds a SyntaxTree of every parse in addition to calling
+        the callbacks. The nodes of the last tree are reused. */
+    void setBuildTree(bool enable) { p_buildTree = enable; }
+    bool isBuildTree() const { return p_buildTree; }
+    /** Tree of the last parse, empty without setBuildTree() */
+    const SyntaxTree& syntaxTree() const { return p_tree; }
+    /** Text of node @p i of syntaxTree(),
+        empty after parse(QIODevice*) and parse(ChunkFunc) */
+    QString nodeText(int i) const;
 
-    void parse(const QString& text);
     int numNodesVisited() const { return p_visited; }
+    /** Number of rule results taken from the memo in the last parse */
+    int numMemoHits() const { return p_memoHits; }
     const QString& text() const { return p_text; }
+    /** The stream of the last parse(QIODevice*), or NULL */
+    const TokenStream* tokenStream() const { return p_stream.get(); }
 
+    /** Parses rule @p r at the current token as subrule @p subIdx
+        of @p parent. Runs on an explicit stack of frames, nesting is
+        only limited by memory. */
     bool parseRule(const Rule* r, const Rule* parent=nullptr, int subIdx=-1);
-    bool parseRule_(const Rule* r);
 
     const LexxedToken& curToken() const { return p_look; }
+    /** Rules symbol id of curToken(), or -1 */
+    int curSymbol() const { return p_lookId; }
+    const std::vector<LexxedToken>& lexxedTokens() const { return p_tokens; }
     bool forward();
     void setPos(size_t);
     void pushPos() { p_posStack.push_back(p_lookPos); }
     void popPos();
 
 private:
-    Rules p_rules;
-    Tokens p_lexxer;
+    const ParseResult& p_parse();
+    bool p_parseTable();
+    /** Failed subrule @p idx of @p r is a syntax error to recover
+        from, see Rules::setSyncTokens() */
+    bool p_isError(const Rule* r, int idx, bool optional) const
+        { return r->subRules()[idx].rule->isSync()
+              && curToken().isValid() && p_lookId != Rules::ID_EOF
+              && (!optional || !parseTable().canFollow(r, idx, p_lookId)); }
+    /** Reports the failure of subrule @p idx of @p r at the
+        lookahead and skips to behind the next sync token */
+    void p_recover(const Rule* r, int idx);
+    /** Appends a diagnostic for the furthest token reached */
+    void p_unexpected(const QString& context);
+    /** Optional or repeated subrule @p r can start at the lookahead */
+    bool p_canEnter(const Rule* r) const
+        { return curToken().isValid() && p_lookId != Rules::ID_EOF
+              && (r->isNullable() || r->canStartWith(p_lookId)); }
+    /** Calls the callbacks of rule @p r, matched from @p from,
+        as subrule @p subIdx of @p parent */
+    void p_emitRule(const Rule* r, const Rule* parent, int subIdx,
+                    const SourcePos& from);
+    void p_emit(const Rule::Callback& func, const Rule* r,
+                const SourcePos& from, int to);
+    /** End of the text of a rule matched from @p from
+        up to the lookahead, without trailing whitespace */
+    int p_emitEnd(const SourcePos& from) const;
+    /** Calls @p func, or appends it to p_log */
+    void p_call(const Rule::Callback& func, const Rule* r,
+                const SourcePos& from, int to);
+    /** Calls the callbacks in p_log */
+    void p_dispatchLog();
+    int p_textEnd() const;
+    QString p_textMid(int pos, int len) const;
+    /** Length of the whitespace character ending at @p pos, or 0 */
+    int p_spaceBefore(int pos) const;
+
+    bool p_hasToken(size_t i)
+        { return p_stream ? p_stream->has(i) : i < p_tokens.size(); }
+    const LexxedToken& p_token(size_t i) const
+        { return p_stream ? p_stream->at(i) : p_tokens[i]; }
+    /** Keeps the stream from releasing tokens from @p i on */
+    void p_pin(size_t i) { if (p_stream) p_pins.push_back(i); }
+    void p_unpin() { if (p_stream) p_pins.pop_back(); }
+
+    /** Callback of rule @p r in this Parser, or NULL */
+    const Rule::Callback* p_callback(const Rule* r) const
+    {
+        if (size_t(r->id()) < p_funcs.size() && p_funcs[r->id()])
+            return &p_funcs[r->id()];
+        return r->p_func ? &r->p_func : nullptr;
+    }
+    /** Callback of subrule @p idx of @p r in this Parser, or NULL */
+    const Rule::Callback* p_callback(const Rule* r, int idx) const
+    {
+        if (size_t(r->id()) < p_subFuncs.size()
+                && size_t(idx) < p_subFuncs[r->id()].size()
+                && p_subFuncs[r->id()][idx])
+            return &p_subFuncs[r->id()][idx];
+        const Rule::SubRule& sub = r->subRules()[idx];
+        return sub.func ? &sub.func : nullptr;
+    }
+
+    std::shared_ptr<const CompiledGrammar> p_grammar;
+    /** Arguments of connect(), idx is -1 for the rule */
+    struct Connection
+    {
+        QString name;
+        int idx;
+        Rule::Callback func;
+    };
+    std::vector<Connection> p_connections;
+    /** Sets p_funcs or p_subFuncs for @p c, returns false
+        if the rule or subrule does not exist */
+    bool p_connect(const Connection& c);
+    /** Callbacks of connect() per rule id */
+    std::vector<Rule::Callback> p_funcs;
+    std::vector<std::vector<Rule::Callback>> p_subFuncs;
+    Engine p_engine, p_usedEngine;
+    int p_lexxerThreads;
     QString p_text;
+    Utf8Input p_utf8;
     std::vector<LexxedToken> p_tokens;
+    std::shared_ptr<TokenStream> p_stream;
+    /** Token positions the parser may return to, ascending */
+    std::vector<size_t> p_pins;
     std::vector<size_t> p_posStack;
     LexxedToken p_look;
+    int p_lookId;
     size_t p_lookPos;
-    int p_level, p_visited;
+    /** Furthest token index reached, and the token there */
+    size_t p_furthest;
+    LexxedToken p_furthestToken;
+    int p_visited;
+    ParseResult p_result;
+
+    /** A rule in progress in the table engine */
+    struct TableFrame
+    {
+        const Rule* rule, * parent;
+        /** index in parent */
+        int subIdx;
+        /** next subrule of T_AND, chosen one of T_OR,
+            size of p_ops at start of T_OPERATORS, or -1 */
+        int idx;
+        /** subrule idx is repeated if it fits again */
+        bool again;
+        bool pinned;
+        SourcePos from;
+    };
+    std::vector<TableFrame> p_tableFrames;
+
+    enum FrameState { S_START, S_CALL, S_RESULT, S_REPEAT, S_NEXT };
+    /** A rule in progress in the backtracking engine */
+    struct Frame
+    {
+        const Rule* rule;
+        /** The parent, if the subrule has a callback */
+        const Rule* parent;
+        SourcePos from;
+        /** Token index at start and of the current repetition */
+        qint32 start, pos;
+        /** Subrule of T_AND or index into Rule::alternatives() */
+        qint32 idx;
+        /** Size of p_emits at start if memoized, or -1 */
+        qint32 emitBegin;
+        qint32 subIdx;
+        /** Size of p_log at start */
+        qint32 logBegin;
+        /** Number of diagnostics at start */
+        qint32 diagBegin;
+        /** Open node in p_tree, or -1 */
+        qint32 node;
+        /** Furthest token index the rule looked at */
+        qint32 examined;
+        quint8 state;
+        bool emits;
+    };
+    /** Starts rule @p r, returns true if a frame was pushed,
+        otherwise writes the result to @p ret */
+    bool p_enter(const Rule* r, const Rule* parent, int subIdx, bool* ret);
+    /** Stores the memo and calls the callbacks of a finished rule */
+    void p_finish(const Frame& f, bool ret);
+    /** Takes the result for @p f from the previous parse,
+        returns false if there is none that is still valid */
+    bool p_reuseMemo(const Frame& f, bool* ret);
+    /** Advance the frame at @p fi with the result @p ret of the last
+        subrule. Return true if a subrule frame was pushed, false when
+        the rule is finished with the result in @p ret */
+    bool p_stepAnd(size_t fi, bool* ret);
+    bool p_stepOr(size_t fi, bool* ret);
+    bool p_stepOperators(size_t fi, bool* ret);
+
+    /** An operator of a T_OPERATORS rule waiting for its operand */
+    struct PendingOp
+    {
+        const Operator* op;
+        SourcePos from;
+        qint32 pos;
+        /** Size of p_tree before the operator */
+        qint32 node;
+    };
+    /** Pushes the operator at the current token and moves behind it */
+    void p_pushOp(const Operator* op);
+    /** Applies the pending operators above @p base that bind before
+        @p next, or all if @p next is NULL */
+    void p_reduceOps(size_t base, const Operator* next);
+    /** Discards the pending operators above @p base */
+    void p_dropOps(size_t base);
+    std::vector<PendingOp> p_ops;
+    static quint64 p_memoKey(const Frame& f)
+        { return (quint64(f.start) << 32) | quint32(f.rule->id()); }
+    std::vector<Frame> p_frames;
+
+    /** A callback call, recorded for replay in packrat mode,
+        or until the parse succeeded in p_log */
+    struct Emit
+    {
+        const Rule::Callback* func;
+        const Rule* rule;
+        SourcePos from;
+        int to;
+    };
+    /** Result of a rule at a token position,
+        end is the token index behind the rule or -1 on failure */
+    struct Memo
+    {
+        qint32 end, emitBegin, emitEnd;
+        /** Nodes of the result in p_tree */
+        qint32 nodeBegin, nodeEnd;
+        /** Furthest token index looked at */
+        qint32 examined;
+    };
+    /** p_memoize is p_packrat for the current parse */
+    bool p_packrat, p_memoize;
+    int p_memoHits;
+    std::vector<Emit> p_emits;
+    /** Memo per token index << 32 | rule id */
+    std::unordered_map<quint64, Memo> p_memo;
+    /** p_deferring is p_defer for the current parse */
+    bool p_defer, p_deferring;
+    int p_discarded;
+    std::vector<Emit> p_log;
+    bool p_buildTree;
+    SyntaxTree p_tree;
+
+    bool p_incremental;
+    int p_reused;
+    /** Token indices of the last edit: new tokens [first, first +
+        numNew) replaced old ones, followers moved by tokenShift */
+    struct Reuse
+    {
+        bool active;
+        qint32 first, numNew, tokenShift, charShift, lineShift;
+    };
+    Reuse p_reuse;
+    /** p_memo, p_emits and p_tree of the previous parse */
+    std::unordered_map<quint64, Memo> p_prevMemo;
+    std::vector<Emit> p_prevEmits;
+    SyntaxTree p_prevTree;
+    /** p_memo refers to nodes in p_tree */
+    bool p_memoTree;
 };
 
+/** Text and position of a parsed Rule, handed to the Rule::Callback.
+
+    A token holds a shallow copy of the parsed QString, which is
+    implicitly shared and costs no allocation. It stays valid after
+    the next parse and after the Parser is gone, so callbacks may keep
+    it, like MathParser::emits does. */
 class ParsedToken
 {
 public:
-    ParsedToken() : p_rule(nullptr) { }
+    ParsedToken() : p_offset(0), p_len(0), p_rule(nullptr) { }
+    /** @p len chars of @p text from @p pos, matched by @p rule */
+    ParsedToken(const QString& text, const SourcePos& pos, int len,
+                const Rule* rule)
+        : p_pos(pos), p_text(text), p_offset(pos.pos()), p_len(len),
+          p_rule(rule) { }
 
-    bool isValid() const { return !p_text.isEmpty(); }
+    bool isValid() const { return p_len > 0; }
 
     const SourcePos& pos() const { return p_pos; }
-    const QString& text() const { return p_text; }
+    /** Copy of the matched text */
+    QString text() const { return textRef().toString(); }
+    /** The matched text without copying,
+        valid as long as this ParsedToken */
+    QStringRef textRef() const
+        { return QStringRef(&p_text, p_offset, p_len); }
     const Rule* rule() const { return p_rule; }
 
     QString toString() const
@@ -87,7 +510,10 @@ public:
 private:
     friend class Parser;
     SourcePos p_pos;
+    /** The parsed text, or a copy of the matched part only
+        for UTF-8 and streamed input */
     QString p_text;
+    int p_offset, p_len;
     const Rule* p_rule;
 };
 
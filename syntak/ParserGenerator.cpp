@@ -0,0 +1,514 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <set>
+
+#include "ParserGenerator.h"
+
+namespace {
+
+    /** Members of every generated class, %1 is the class name */
+    const char* const classHelpers = R"(
+    void p_setPos(size_t pos)
+        { p_pos = pos; p_sym = p_symbolOf[p_tokens[pos].kind()]; }
+    /** Moves behind token @p symbol, calls its callbacks */
+    bool p_shift(int symbol, int sub)
+    {
+        const size_t from = p_pos;
+        p_setPos(p_pos + 1);
+        p_done(symbol, sub, from);
+        return true;
+    }
+    /** Calls the callbacks of @p symbol, matched from token @p from,
+        as subrule @p sub */
+    void p_done(int symbol, int sub, size_t from)
+    {
+        if ((sub >= 0 && p_subFuncs[sub]) || p_funcs[symbol])
+            p_emit(symbol, sub, from);
+    }
+    void p_emit(int symbol, int sub, size_t from);
+
+    void p_pushOp(const Op* op);
+    /** Applies the pending operators above @p base that bind
+        before @p next, or all if @p next is NULL */
+    void p_reduceOps(size_t base, const Op* next);
+
+    Tokens p_lexxer;
+    /** Symbol per LexxedToken::kind(), or -1 */
+    std::vector<int> p_symbolOf;
+    /** Rule per symbol, or NULL */
+    std::vector<const Rule*> p_rules;
+    std::vector<Rule::Callback> p_funcs, p_subFuncs;
+    QString p_text;
+    std::vector<LexxedToken> p_tokens;
+    size_t p_pos;
+    int p_sym;
+    std::vector<PendingOp> p_ops;
+};
+
+inline %1::%1(const Tokens& lexxer, const Rules* rules)
+    : p_lexxer      (lexxer)
+    , p_symbolOf    (lexxer.tokens().size() + 1, -1)
+    , p_rules       (NUM_SYMBOLS, nullptr)
+    , p_funcs       (NUM_SYMBOLS)
+    , p_subFuncs    (NUM_SUBS)
+    , p_pos         (0)
+    , p_sym         (S_EOF)
+{
+    p_lexxer.prepare();
+    p_symbolOf[Tokens::K_EOF] = S_EOF;
+    for (size_t i=0; i<lexxer.tokens().size(); ++i)
+        for (int s=1; s<=NUM_TOKENS; ++s)
+            if (lexxer.tokens()[i].name() == QString(symbolName(s)))
+                p_symbolOf[i + 1] = s;
+    if (rules)
+        for (int s=1; s<NUM_SYMBOLS; ++s)
+        {
+            const int id = rules->id(symbolName(s));
+            p_rules[s] = id >= 0 ? rules->rule(id) : nullptr;
+        }
+}
+
+inline bool %1::connect(const QString& name, Rule::Callback f)
+{
+    for (int s=1; s<NUM_SYMBOLS; ++s)
+        if (name == QString(symbolName(s)))
+        {
+            p_funcs[s] = f;
+            return true;
+        }
+    return false;
+}
+
+inline bool %1::connect(const QString& name, int idx, Rule::Callback f)
+{
+    for (int i=0; i<NUM_SUBS; ++i)
+        if (p_subRule(i)[1] == idx
+                && name == QString(symbolName(p_subRule(i)[0])))
+        {
+            p_subFuncs[i] = f;
+            return true;
+        }
+    return false;
+}
+
+inline bool %1::parse(const QString& text)
+{
+    p_text = text;
+    p_tokens.clear();
+    p_ops.clear();
+    p_lexxer.tokenize(p_text, p_tokens);
+    p_setPos(0);
+    return %2(SUB_NONE) && p_sym == S_EOF;
+}
+
+inline void %1::p_emit(int symbol, int sub, size_t from)
+{
+    const LexxedToken& first = p_tokens[from];
+    int len = 0;
+    if (p_pos > from)
+    {
+        const LexxedToken& last = p_tokens[p_pos - 1];
+        len = last.pos().pos() + last.length() - first.pos().pos();
+    }
+    const ParsedToken t(p_text, first.pos(), len, p_rules[symbol]);
+    if (sub >= 0 && p_subFuncs[sub])
+        p_subFuncs[sub](t);
+    if (p_funcs[symbol])
+        p_funcs[symbol](t);
+}
+
+inline void %1::p_pushOp(const Op* op)
+{
+    const PendingOp p = { op, p_pos };
+    p_ops.push_back(p);
+    p_setPos(p_pos + 1);
+}
+
+inline void %1::p_reduceOps(size_t base, const Op* next)
+{
+    while (p_ops.size() > base
+           && (!next || p_ops.back().op->precedence > next->precedence
+               || (p_ops.back().op->precedence == next->precedence
+                   && next->kind == Operator::O_LEFT)))
+    {
+        const PendingOp p = p_ops.back();
+        p_ops.pop_back();
+        p_done(p.op->rule, SUB_NONE, p.pos);
+    }
+}
+)";
+
+    QString cString(const QString& s)
+    {
+        QString r = "\"";
+        for (int i=0; i<s.size(); ++i)
+        {
+            if (s[i] == '\\' || s[i] == '"')
+                r += "\\";
+            r += s[i];
+        }
+        return r + "\"";
+    }
+
+    QString operatorKind(Operator::Kind k)
+    {
+        return k == Operator::O_LEFT ? "Operator::O_LEFT"
+             : k == Operator::O_RIGHT ? "Operator::O_RIGHT"
+             : "Operator::O_PREFIX";
+    }
+
+} // namespace
+
+
+ParserGenerator::ParserGenerator(const Rules& rules)
+    : p_rules       (rules)
+    , p_className   ("GeneratedParser")
+    , p_numTokens   (0)
+{
+}
+
+QString ParserGenerator::identifier(const QString& name)
+{
+    QString id;
+    for (int i=0; i<name.size(); ++i)
+        id += name[i].isLetterOrNumber() && name[i].unicode() < 128
+                ? name[i] : QChar('_');
+    if (id.isEmpty() || id[0].isDigit())
+        id.prepend("_");
+    return id;
+}
+
+QString ParserGenerator::p_symbol(int id) const
+{
+    return id == Rules::ID_EOF ? QString("S_EOF") : "S_" + p_ids[id];
+}
+
+QString ParserGenerator::p_sub(const Rule* r, int idx) const
+{
+    return QString("SUB_%1_%2").arg(p_ids[r->id()]).arg(idx);
+}
+
+QString ParserGenerator::p_call(const Rule* r, int idx) const
+{
+    const Rule* sub = r->subRules()[idx].rule;
+    if (sub->type() == Rule::T_TOKEN)
+        return QString("(p_sym == %1 && p_shift(%1, %2))")
+                .arg(p_symbol(sub->id())).arg(p_sub(r, idx));
+    return QString("p_parse_%1(%2)").arg(p_ids[sub->id()]).arg(p_sub(r, idx));
+}
+
+QString ParserGenerator::generate()
+{
+    p_errors.clear();
+    p_rules.check();
+    p_errors = p_rules.errors();
+    const Rule* top = p_rules.topRule();
+    if (p_errors.isEmpty() && !top)
+        p_errors << "No top-level rule defined";
+    if (!p_errors.isEmpty())
+        return QString();
+
+    p_ids.clear();
+    p_ids << "EOF";
+    p_numTokens = 0;
+    std::set<QString> used;
+    for (int id=1; id<p_rules.numIds(); ++id)
+    {
+        const Rule* r = p_rules.rule(id);
+        if (r->type() == Rule::T_TOKEN)
+            p_numTokens = id;
+        const QString ident = identifier(r->name());
+        p_ids << ident;
+        if (!used.insert(ident).second || ident == "EOF")
+            p_errors << QString("Rule %1 has the identifier %2 of "
+                                "another symbol").arg(r->name()).arg(ident);
+    }
+    if (!p_errors.isEmpty())
+        return QString();
+
+    const QString guard = identifier(p_className).toUpper() + "_H";
+    QString s = QString("/* Generated by syntak-gen%1, do not edit */\n\n")
+                .arg(p_sourceName.isEmpty() ? QString()
+                                            : " from " + p_sourceName);
+    s += "#ifndef " + guard + "\n#define " + guard + "\n\n";
+    s += "#include <vector>\n\n#include \"Tokens.h\"\n#include \"Rules.h\"\n"
+         "#include \"Parser.h\"\n\n";
+
+    s += QString("/** Parser for rule %1, parses like Parser::E_BACKTRACKING\n"
+                 "    without memo and error recovery */\n").arg(top->name());
+    s += "class " + p_className + "\n{\npublic:\n";
+    s += "    /** Symbol ids, the same as Rules::id() */\n"
+         "    enum Symbol\n    {\n        S_EOF,\n";
+    for (int id=1; id<p_rules.numIds(); ++id)
+        s += "        " + p_symbol(id) + ",\n";
+    s += "        NUM_SYMBOLS\n    };\n";
+    s += QString("    /** Symbols 1 to NUM_TOKENS are tokens */\n"
+                 "    enum { NUM_TOKENS = %1 };\n\n").arg(p_numTokens);
+    s += QString(
+        "    /** Parses the tokens of @p lexxer, matched by name. With\n"
+        "        @p rules, ParsedToken::rule() is the Rule of the same name */\n"
+        "    explicit %1(const Tokens& lexxer, const Rules* rules = nullptr);\n"
+        "\n"
+        "    /** Calls @p f for rule @p name,\n"
+        "        returns false if there is no such rule */\n"
+        "    bool connect(const QString& name, Rule::Callback f);\n"
+        "    /** Calls @p f for subrule @p idx of rule @p name */\n"
+        "    bool connect(const QString& name, int idx, Rule::Callback f);\n"
+        "\n"
+        "    /** Lexxes and parses @p text,\n"
+        "        returns true if the top rule matched all of it */\n"
+        "    bool parse(const QString& text);\n"
+        "\n"
+        "    const QString& text() const { return p_text; }\n"
+        "    const std::vector<LexxedToken>& lexxedTokens() const\n"
+        "        { return p_tokens; }\n"
+        "\n"
+        "    static const char* symbolName(int symbol);\n\n"
+        "private:\n").arg(p_className);
+
+    s += "    /** Entry of the operator table of a T_OPERATORS rule */\n"
+         "    struct Op\n    {\n        int precedence, kind, rule;\n    };\n"
+         "    struct PendingOp\n    {\n        const Op* op;\n"
+         "        size_t pos;\n    };\n\n";
+
+    // a callback slot per subrule
+    s += "    enum Sub\n    {\n        SUB_NONE = -1,\n";
+    QString subTable;
+    for (int id=p_numTokens+1; id<p_rules.numIds(); ++id)
+    {
+        const Rule* r = p_rules.rule(id);
+        for (size_t i=0; i<r->subRules().size(); ++i)
+        {
+            s += "        " + p_sub(r, i) + ",\n";
+            subTable += QString("            { %1, %2 },\n")
+                        .arg(p_symbol(id)).arg(int(i));
+        }
+    }
+    s += "        NUM_SUBS\n    };\n";
+    s += "    /** Rule symbol and index of a Sub */\n"
+         "    static const int* p_subRule(int sub)\n    {\n"
+         "        static const int subs[][2] =\n        {\n"
+         + subTable + "        };\n        return subs[sub];\n    }\n\n";
+
+    for (int id=p_numTokens+1; id<p_rules.numIds(); ++id)
+    {
+        const Rule* r = p_rules.rule(id);
+        s += "    bool p_parse_" + p_ids[id] + "(int sub);\n";
+        if (r->type() == Rule::T_OPERATORS)
+            s += "    static const Op* p_operators_" + p_ids[id] + "();\n"
+                 "    const Op* p_prefix_" + p_ids[id] + "() const;\n"
+                 "    const Op* p_binary_" + p_ids[id] + "() const;\n";
+    }
+
+    s += QString(classHelpers).arg(p_className)
+            .arg("p_parse_" + p_ids[top->id()]);
+
+    s += "\ninline const char* " + p_className
+       + "::symbolName(int symbol)\n{\n"
+         "    static const char* const names[] =\n    {\n";
+    for (int id=0; id<p_rules.numIds(); ++id)
+        s += "        " + cString(id ? p_rules.rule(id)->name()
+                                     : QString("EOF")) + ",\n";
+    s += "    };\n"
+         "    return symbol >= 0 && symbol < NUM_SYMBOLS ? names[symbol] : \"\";\n"
+         "}\n";
+
+    for (int id=p_numTokens+1; id<p_rules.numIds(); ++id)
+        s += p_ruleFunction(p_rules.rule(id));
+
+    s += "\n#endif // " + guard + "\n";
+    return s;
+}
+
+QString ParserGenerator::p_ruleFunction(const Rule* r) const
+{
+    QString s = "\n/* " + r->toDefinitionString() + " */\ninline bool "
+              + p_className + "::p_parse_" + p_ids[r->id()] + "(int sub)\n{\n";
+
+    // like Parser::p_enter(), fail at EOF and on tokens not in FIRST,
+    // the dispatch of T_OR does the latter
+    if (r->isNullable())
+        s += "    if (p_sym == S_EOF)\n        return false;\n";
+    else if (r->type() != Rule::T_OR)
+    {
+        s += "    switch (p_sym)\n    {\n";
+        for (int id=1; id<=p_numTokens; ++id)
+            if (r->canStartWith(id))
+                s += "        case " + p_symbol(id) + ":\n";
+        s += "            break;\n        default:\n"
+             "            return false;\n    }\n";
+    }
+    s += "    const size_t from = p_pos;\n";
+
+    switch (r->type())
+    {
+        case Rule::T_AND: s += p_andBody(r); break;
+        case Rule::T_OR: s += p_orBody(r); break;
+        case Rule::T_OPERATORS: s += p_operatorsBody(r); break;
+        case Rule::T_TOKEN: break;
+    }
+
+    s += "    p_done(" + p_symbol(r->id()) + ", sub, from);\n"
+         "    return true;\n}\n";
+
+    if (r->type() == Rule::T_OPERATORS)
+        s += p_operatorTable(r);
+    return s;
+}
+
+QString ParserGenerator::p_andBody(const Rule* r) const
+{
+    QString s;
+    bool consumed = false;
+    for (size_t i=0; i<r->subRules().size(); ++i)
+    {
+        const Rule::SubRule& sub = r->subRules()[i];
+        const QString call = p_call(r, i);
+        if (!sub.isOptional)
+            s += "    if (!" + call + ")\n"
+               + (consumed ? "    {\n        p_setPos(from);\n"
+                             "        return false;\n    }\n"
+                           : "        return false;\n");
+        else if (!sub.isRecursive)
+            s += "    " + call + ";\n";
+        if (sub.isRecursive)
+            s += "    for (size_t pos = p_pos;\n         " + call
+               + " && p_pos != pos; )\n        pos = p_pos;\n";
+        consumed = true;
+    }
+    return s;
+}
+
+QString ParserGenerator::p_orBody(const Rule* r) const
+{
+    auto expr = [&](const std::vector<int>& alts)
+    {
+        QStringList e;
+        for (int a : alts)
+        {
+            // only dispatched to on its own symbol
+            const Rule* sub = r->subRules()[a].rule;
+            e << (sub->type() == Rule::T_TOKEN
+                    ? QString("p_shift(%1, %2)").arg(p_symbol(sub->id()))
+                                                .arg(p_sub(r, a))
+                    : p_call(r, a));
+        }
+        return e.isEmpty() ? QString("false") : e.join("\n                || ");
+    };
+
+    QString s = "    bool ok;\n    switch (p_sym)\n    {\n";
+    // symbols with the same alternatives share a case
+    std::vector<bool> done(p_numTokens + 1, false);
+    for (int id=1; id<=p_numTokens; ++id)
+    {
+        const std::vector<int>& alts = r->alternatives(id);
+        if (done[id] || alts == r->alternatives(0))
+            continue;
+        for (int other=id; other<=p_numTokens; ++other)
+            if (!done[other] && r->alternatives(other) == alts)
+            {
+                s += "        case " + p_symbol(other) + ":\n";
+                done[other] = true;
+            }
+        s += "            ok = " + expr(alts) + ";\n            break;\n";
+    }
+    s += "        default:\n            ok = " + expr(r->alternatives(0))
+       + ";\n            break;\n    }\n"
+         "    if (!ok)\n        return false;\n";
+    return s;
+}
+
+QString ParserGenerator::p_operatorsBody(const Rule* r) const
+{
+    const QString id = p_ids[r->id()];
+    return QString(
+        "    const size_t base = p_ops.size();\n"
+        "    for (;;)\n"
+        "    {\n"
+        "        while (const Op* o = p_prefix_%1())\n"
+        "            p_pushOp(o);\n"
+        "        if (!%2)\n"
+        "        {\n"
+        "            // go back before the last binary operator, if any\n"
+        "            size_t i = p_ops.size();\n"
+        "            while (i > base\n"
+        "                   && p_ops[i-1].op->kind == Operator::O_PREFIX)\n"
+        "                --i;\n"
+        "            if (i == base)\n"
+        "            {\n"
+        "                p_ops.resize(base);\n"
+        "                p_setPos(from);\n"
+        "                return false;\n"
+        "            }\n"
+        "            p_setPos(p_ops[i-1].pos);\n"
+        "            p_ops.resize(i-1);\n"
+        "            p_reduceOps(base, nullptr);\n"
+        "            break;\n"
+        "        }\n"
+        "        const Op* o = p_binary_%1();\n"
+        "        p_reduceOps(base, o);\n"
+        "        if (!o)\n"
+        "            break;\n"
+        "        p_pushOp(o);\n"
+        "    }\n").arg(id).arg(p_call(r, 0));
+}
+
+QString ParserGenerator::p_operatorTable(const Rule* r) const
+{
+    QString s = QString("\ninline const %1::Op* %1::p_operators_%2()\n{\n"
+                        "    static const Op ops[] =\n    {\n")
+                .arg(p_className).arg(p_ids[r->id()]);
+    for (const Operator& o : r->operators())
+        s += QString("        { %1, %2, %3 },\n").arg(o.precedence())
+                .arg(operatorKind(o.kind()))
+                .arg(p_symbol(o.callRule()->id()));
+    s += "    };\n    return ops;\n}\n";
+    return s + p_operatorLookup(r, true) + p_operatorLookup(r, false);
+}
+
+QString ParserGenerator::p_operatorLookup(const Rule* r, bool prefix) const
+{
+    const QString id = p_ids[r->id()];
+    QString cases;
+    const QList<Operator>& ops = r->operators();
+    for (int sym=1; sym<=p_numTokens; ++sym)
+    {
+        const Operator* o = prefix ? r->prefixOperator(sym)
+                                   : r->binaryOperator(sym);
+        for (int i=0; o && i<ops.size(); ++i)
+            if (&ops[i] == o)
+                cases += QString("        case %1: "
+                                 "return p_operators_%2() + %3;\n")
+                            .arg(p_symbol(sym)).arg(id).arg(i);
+    }
+    QString s = QString("\ninline const %1::Op* %1::p_%2_%3() const\n{\n")
+                .arg(p_className).arg(prefix ? "prefix" : "binary").arg(id);
+    if (cases.isEmpty())
+        return s + "    return nullptr;\n}\n";
+    return s + "    switch (p_sym)\n    {\n" + cases
+             + "        default: return nullptr;\n    }\n}\n";
+}
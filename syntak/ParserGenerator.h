@@ -0,0 +1,85 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef PARSERGENERATOR_H
+#define PARSERGENERATOR_H
+
+#include <QString>
+#include <QStringList>
+
+#include "Rules.h"
+
+/** Writes a recursive descent parser for Rules as C++ source.
+
+    The output is one header with a class that parses like
+    Parser::E_BACKTRACKING without memo and error recovery:
+    one function per rule, a switch on the lookahead symbol where a
+    rule has alternatives, token checks inlined, and a hook for the
+    callbacks after every rule and subrule.
+    The generated class lexxes with a Tokens given to its constructor,
+    whose tokens are matched by name, and connects Rule::Callbacks
+    by name like Parser::connect(). See the syntak-gen tool. */
+class ParserGenerator
+{
+public:
+    explicit ParserGenerator(const Rules& rules);
+
+    const QString& className() const { return p_className; }
+    void setClassName(const QString& name) { p_className = name; }
+    /** Named in the comment on top of the output */
+    void setSourceName(const QString& name) { p_sourceName = name; }
+
+    /** Returns the header, or an empty string and the reasons
+        in errors() if the rules are not valid */
+    QString generate();
+    const QStringList& errors() const { return p_errors; }
+
+    /** @p name with every character that is not allowed
+        in a C++ identifier replaced by '_' */
+    static QString identifier(const QString& name);
+
+private:
+    QString p_symbol(int id) const;
+    QString p_sub(const Rule* r, int idx) const;
+    /** Expression parsing subrule @p idx of @p r, true on a match */
+    QString p_call(const Rule* r, int idx) const;
+    QString p_ruleFunction(const Rule* r) const;
+    QString p_andBody(const Rule* r) const;
+    QString p_orBody(const Rule* r) const;
+    QString p_operatorsBody(const Rule* r) const;
+    /** The Operators of @p r and their lookup by symbol */
+    QString p_operatorTable(const Rule* r) const;
+    QString p_operatorLookup(const Rule* r, bool prefix) const;
+
+    Rules p_rules;
+    QString p_className, p_sourceName;
+    QStringList p_errors;
+    /** identifier() per symbol id */
+    QStringList p_ids;
+    int p_numTokens;
+};
+
+#endif // PARSERGENERATOR_H
@@ -29,6 +29,7 @@ SOFTWARE.
 
 #include "Rules.h"
 #include "Tokens.h"
+#include "GrammarData.h"
 
 bool Rule::contains(const QString& n) const
 {
@@ -63,7 +64,7 @@ bool Rule::wants(const QString &n) const
 
 void Rule::connect(int idx, Callback f)
 {
-    if (idx >= 0 && idx < p_subRules.size())
+    if (idx >= 0 && idx < int(p_subRules.size()))
         p_subRules[idx].func = f;
 }
 
@@ -74,7 +75,7 @@ Rule* Rules::find(const QString &name)
     if (i == p_rules.end())
     {
         qWarning()<<"rule "<<name<<" not added";
-        abort();
+        return nullptr;
     }
     return i->second;
 }
@@ -88,6 +89,26 @@ QString Rule::toDefinitionString() const
     switch (type())
     {
         case T_TOKEN: s += "\"" + token().tokenString() + "\""; break;
+        case T_OPERATORS:
+        {
+            s += subRules()[0].name;
+            if (subRules()[0].func)
+                s += "!";
+            s += " <<";
+            bool comma = false;
+            for (const Operator& o : operators())
+            {
+                s += QString("%1 %2 %3 %4 %5")
+                        .arg(comma ? "," : "").arg(o.token())
+                        .arg(o.precedence())
+                        .arg(o.kind() == Operator::O_LEFT ? "left"
+                           : o.kind() == Operator::O_RIGHT ? "right"
+                           : "prefix")
+                        .arg(o.rule());
+                comma = true;
+            }
+        }
+        break;
         case T_AND:
         case T_OR:
         {
@@ -113,6 +134,8 @@ QString Rule::toDefinitionString() const
         }
         break;
     }
+    if (type() != T_TOKEN && isSync())
+        s += " ~ " + syncTokens().join(" ");
     return s;
 }
 
@@ -129,6 +152,30 @@ Rule::SubRule Rules::makeSubRule(const QString& s)
 
 }
 
+Rules& Rules::operator = (const Rules& other)
+{
+    if (this == &other)
+        return *this;
+    p_clear();
+    for (auto& i : other.p_rules)
+        p_add(new Rule(*i.second));
+    // resolve the subrules to the copies
+    if (other.p_checked)
+        p_check();
+    return *this;
+}
+
+void Rules::p_clear()
+{
+    for (auto& i : p_rules)
+        delete i.second;
+    p_rules.clear();
+    p_byId.clear();
+    p_topRule = nullptr;
+    p_checked = false;
+    p_errors.clear();
+}
+
 void Rules::p_add(Rule* r)
 {
     p_rules.insert(std::make_pair(r->name(), r));
@@ -142,7 +189,7 @@ Rule* Rules::createAnd(const QString& name,
     r->p_name = name;
     r->p_type = Rule::T_AND;
     for (auto& s : rules)
-        r->p_subRules << makeSubRule(s);
+        r->p_subRules.push_back(makeSubRule(s));
     p_add(r);
     return r;
 }
@@ -155,6 +202,23 @@ Rule* Rules::createOr(const QString& name,
     return r;
 }
 
+Rule* Rules::createOperators(const QString& name, const QString& operand,
+                             const QList<Operator>& table)
+{
+    auto r = createAnd(name, operand);
+    r->p_type = Rule::T_OPERATORS;
+    r->p_operators = table;
+
+    std::map<QString, QStringList> levels;
+    for (const Operator& o : table)
+        if (!levels[o.rule()].contains(o.token()))
+            levels[o.rule()] << o.token();
+    for (auto& l : levels)
+        if (p_rules.find(l.first) == p_rules.end())
+            createOr(l.first, l.second);
+    return r;
+}
+
 Rule* Rules::createToken(const Token& t)
 {
     auto r = new Rule();
@@ -171,6 +235,15 @@ void Rules::addTokens(const Tokens& tok)
         createToken(t);
 }
 
+void Rules::setSyncTokens(const QString& name, const QStringList& tokens)
+{
+    if (auto r = find(name))
+    {
+        r->p_syncNames = tokens;
+        p_checked = false;
+    }
+}
+
 void Rules::connect(const QString &name, Rule::Callback f)
 {
     if (auto r = find(name))
@@ -203,44 +276,405 @@ QString Rules::toDefinitionString() const
     return s;
 }
 
+Rules Rules::fromDefinitionString(const QString& text, QString* error)
+{
+    Rules rules;
+    const QStringList lines = text.split("\n");
+    auto fail = [&](int line, const QString& e)
+    {
+        if (error)
+            *error = QString("line %1: %2").arg(line + 1).arg(e);
+        return Rules();
+    };
+    // callback markers are only informative
+    auto symbol = [](QString s)
+    {
+        s = s.trimmed();
+        if (s.endsWith("!"))
+            s.chop(1);
+        return s;
+    };
+
+    for (int i=0; i<lines.size(); ++i)
+    {
+        const QString line = lines[i].trimmed();
+        if (line.isEmpty() || line.startsWith("#"))
+            continue;
+        const int colon = line.indexOf(" : ");
+        if (colon < 1)
+            return fail(i, "expected 'name : definition'");
+        const QString name = symbol(line.left(colon));
+        QString def = line.mid(colon + 3).trimmed();
+
+        if (def.startsWith("\""))
+        {
+            if (def.size() < 3 || !def.endsWith("\""))
+                return fail(i, "unterminated token " + name);
+            rules.createToken(Token(name, def.mid(1, def.size() - 2)));
+            continue;
+        }
+
+        QStringList sync;
+        const int tilde = def.indexOf(" ~ ");
+        if (tilde >= 0)
+        {
+            sync = def.mid(tilde + 3).split(" ", QString::SkipEmptyParts);
+            def = def.left(tilde);
+        }
+
+        const int ops = def.indexOf(" <<");
+        if (ops >= 0)
+        {
+            QList<Operator> table;
+            for (const QString& entry : def.mid(ops + 3).split(","))
+            {
+                const QStringList f = entry.split(" ",
+                                                  QString::SkipEmptyParts);
+                bool ok = f.size() == 4;
+                const int precedence = ok ? f[1].toInt(&ok) : 0;
+                if (!ok || (f[2] != "left" && f[2] != "right"
+                            && f[2] != "prefix"))
+                    return fail(i, "expected 'token precedence "
+                                   "left|right|prefix rule' in " + name);
+                table << Operator(f[0], precedence,
+                                  f[2] == "left" ? Operator::O_LEFT
+                                : f[2] == "right" ? Operator::O_RIGHT
+                                : Operator::O_PREFIX, f[3]);
+            }
+            rules.createOperators(name, symbol(def.left(ops)), table);
+        }
+        else
+        {
+            const bool isOr = def.contains(" | ");
+            QStringList symbols;
+            for (const QString& s : def.split(isOr ? " | " : " ",
+                                              QString::SkipEmptyParts))
+                symbols << symbol(s);
+            if (symbols.isEmpty())
+                return fail(i, "no subrules in " + name);
+            if (isOr)
+                rules.createOr(name, symbols);
+            else
+                rules.createAnd(name, symbols);
+        }
+        if (!sync.isEmpty())
+            rules.setSyncTokens(name, sync);
+    }
+    return rules;
+}
+
+int Rules::id(const QString& name) const
+{
+    auto i = p_rules.find(name);
+    return i == p_rules.end() ? -1 : i->second->id();
+}
+
+void Rules::p_error(const QString& e)
+{
+    qWarning().noquote() << e;
+    p_errors << e;
+}
+
 void Rules::p_check()
 {
     p_topRule = nullptr;
+    p_errors.clear();
+    // rules with errors are not parsed
+    p_checked = true;
+
+    // intern names, terminals first
+    p_byId.assign(1, nullptr);
+    for (auto& i : p_rules)
+        if (i.second->type() == Rule::T_TOKEN)
+            p_byId.push_back(i.second);
+    for (auto& i : p_rules)
+        if (i.second->type() != Rule::T_TOKEN)
+            p_byId.push_back(i.second);
+    for (size_t id=1; id<p_byId.size(); ++id)
+        p_byId[id]->p_id = id;
 
+    std::vector<bool> referenced(p_byId.size(), false);
     for (auto& i : p_rules)
     {
         i.second->p_isTop = false;
+        i.second->p_lastRequired = -1;
+        for (int j=0; j<int(i.second->p_subRules.size()); ++j)
+            if (!i.second->p_subRules[j].isOptional)
+                i.second->p_lastRequired = j;
         for (Rule::SubRule& sub : i.second->p_subRules)
         {
             sub.rule = find(sub.name);
             if (!sub.rule)
-                PARSE_ERROR("Subrule "<<sub.name<<" in "<<i.second->name()
-                            <<" not known");
+            {
+                p_error(QString("Subrule %1 in %2 not known")
+                        .arg(sub.name).arg(i.second->name()));
+                continue;
+            }
+            if (sub.rule != i.second)
+                referenced[sub.rule->id()] = true;
+        }
+
+        Rule* r = i.second;
+        r->p_prefixOf.clear();
+        r->p_binaryOf.clear();
+        for (int j=0; j<r->p_operators.size(); ++j)
+        {
+            Operator& o = r->p_operators[j];
+            Rule* t = find(o.token());
+            if (!t || t->type() != Rule::T_TOKEN)
+            {
+                p_error(QString("Operator %1 in %2 is not a token")
+                        .arg(o.token()).arg(r->name()));
+                continue;
+            }
+            o.p_tokenId = t->id();
+            o.p_callRule = find(o.rule());
+            referenced[t->id()] = referenced[o.p_callRule->id()] = true;
+
+            std::vector<int>& of = o.isPrefix() ? r->p_prefixOf
+                                                : r->p_binaryOf;
+            of.resize(std::max(of.size(), size_t(t->id() + 1)), -1);
+            of[t->id()] = j;
+        }
+
+        r->p_sync.clear();
+        for (const QString& name : r->p_syncNames)
+        {
+            auto it = p_rules.find(name);
+            if (it == p_rules.end() || it->second->type() != Rule::T_TOKEN)
+            {
+                p_error(QString("Sync token %1 of %2 is not a token")
+                        .arg(name).arg(r->name()));
+                continue;
+            }
+            const int id = it->second->id();
+            r->p_sync.resize(std::max(r->p_sync.size(), size_t(id + 1)),
+                             false);
+            r->p_sync[id] = true;
         }
     }
+    if (!p_errors.isEmpty())
+        return;
+
+    p_computeFirst();
 
     // find top rule
     for (auto& i : p_rules)
-    if (i.second->type() != Rule::T_TOKEN)
+    if (i.second->type() != Rule::T_TOKEN && !referenced[i.second->id()])
+    {
+        p_topRule = i.second;
+        i.second->p_isTop = true;
+        //qDebug() << "toprule" << i.second->toString();
+        break;
+    }
+}
+
+void Rules::p_computeFirst()
+{
+    size_t numTerminals = 1;
+    while (numTerminals < p_byId.size()
+           && p_byId[numTerminals]->type() == Rule::T_TOKEN)
+        ++numTerminals;
+
+    for (size_t id=1; id<p_byId.size(); ++id)
+    {
+        Rule* r = p_byId[id];
+        r->p_first.assign(numTerminals, false);
+        r->p_nullable = false;
+        r->p_dispatch.clear();
+        if (r->type() == Rule::T_TOKEN)
+            r->p_first[id] = true;
+    }
+
+    // iterate until stable, rules may be recursive
+    bool changed = true;
+    while (changed)
     {
-        bool contained = false;
-        for (auto& j : p_rules)
-        if (i.second != j.second)
+        changed = false;
+        for (size_t id=numTerminals; id<p_byId.size(); ++id)
         {
-            if (j.second->contains(i.second->name()))
+            Rule* r = p_byId[id];
+            for (const Operator& o : r->p_operators)
+                if (o.isPrefix() && !r->p_first[o.tokenId()])
+                    r->p_first[o.tokenId()] = changed = true;
+            bool nullable = r->type() != Rule::T_OR;
+            for (const Rule::SubRule& sub : r->p_subRules)
+            {
+                for (size_t t=1; t<numTerminals; ++t)
+                    if (sub.rule->p_first[t] && !r->p_first[t])
+                        r->p_first[t] = changed = true;
+
+                if (r->type() == Rule::T_OR)
+                    nullable |= sub.rule->p_nullable;
+                else if (!sub.isOptional && !sub.rule->p_nullable)
+                {
+                    nullable = false;
+                    break;
+                }
+            }
+            if (nullable && !r->p_nullable)
+                r->p_nullable = changed = true;
+        }
+    }
+
+    for (size_t id=numTerminals; id<p_byId.size(); ++id)
+    {
+        Rule* r = p_byId[id];
+        if (r->type() != Rule::T_OR)
+            continue;
+        r->p_dispatch.resize(numTerminals);
+        for (size_t t=0; t<numTerminals; ++t)
+            for (int idx=0; idx<int(r->p_subRules.size()); ++idx)
             {
-                contained = true;
-                break;
+                const Rule* sub = r->p_subRules[idx].rule;
+                if (sub->p_nullable || (t > 0 && sub->p_first[t]))
+                    r->p_dispatch[t].push_back(idx);
             }
+    }
+}
+
+
+QDataStream& operator << (QDataStream& s, const Rules& rules)
+{
+    // in id order, names are only needed for Rules::id()
+    s << qint32(rules.numIds());
+    for (int id=1; id<rules.numIds(); ++id)
+    {
+        const Rule* r = rules.rule(id);
+        s << r->p_name << qint32(r->p_type) << r->p_token
+          << qint32(r->p_lastRequired) << r->p_nullable << r->p_isTop;
+        s << quint32(r->p_subRules.size());
+        for (const Rule::SubRule& sub : r->p_subRules)
+            s << sub.name << qint32(sub.rule->id())
+              << sub.isOptional << sub.isRecursive;
+        GrammarData::write(s, r->p_first);
+        GrammarData::write(s, r->p_dispatch);
+        s << quint32(r->p_operators.size());
+        for (const Operator& o : r->p_operators)
+            s << o.token() << o.rule() << qint32(o.precedence())
+              << qint32(o.kind()) << qint32(o.tokenId())
+              << qint32(o.callRule()->id());
+        GrammarData::write(s, r->p_prefixOf);
+        GrammarData::write(s, r->p_binaryOf);
+        GrammarData::write(s, r->p_syncNames);
+        GrammarData::write(s, r->p_sync);
+    }
+    GrammarData::write(s, rules.p_errors);
+    s << qint32(rules.p_topRule ? rules.p_topRule->id() : -1);
+    return s;
+}
+
+QDataStream& operator >> (QDataStream& s, Rules& rules)
+{
+    rules.p_clear();
+    qint32 numIds;
+    s >> numIds;
+    if (s.status() != QDataStream::Ok
+            || numIds < 1 || numIds > GrammarData::MAX_SIZE)
+    {
+        s.setStatus(QDataStream::ReadCorruptData);
+        return s;
+    }
+    // create all first, subrules refer to later ids
+    rules.p_byId.assign(1, nullptr);
+    for (int id=1; id<numIds; ++id)
+    {
+        rules.p_byId.push_back(new Rule());
+        rules.p_byId.back()->p_id = id;
+    }
+    auto valid = [&](qint32 id) { return id > 0 && id < numIds; };
+    auto corrupt = [&]()
+    {
+        s.setStatus(QDataStream::ReadCorruptData);
+        return false;
+    };
+    auto readRule = [&](Rule* r)
+    {
+        qint32 type, lastRequired;
+        quint32 n;
+        s >> r->p_name >> type >> r->p_token >> lastRequired
+          >> r->p_nullable >> r->p_isTop;
+        r->p_type = Rule::Type(type);
+        r->p_lastRequired = lastRequired;
+        if (!GrammarData::readSize(s, &n))
+            return false;
+        r->p_subRules.resize(n);
+        for (Rule::SubRule& sub : r->p_subRules)
+        {
+            qint32 id;
+            s >> sub.name >> id >> sub.isOptional >> sub.isRecursive;
+            if (!valid(id))
+                return corrupt();
+            sub.rule = rules.p_byId[id];
+        }
+        if (!GrammarData::read(s, r->p_first)
+                || !GrammarData::read(s, r->p_dispatch)
+                || !GrammarData::readSize(s, &n))
+            return false;
+        for (quint32 i=0; i<n; ++i)
+        {
+            Operator o("", 0, Operator::O_LEFT, "");
+            qint32 precedence, kind, tokenId, callRule;
+            s >> o.p_token >> o.p_rule >> precedence >> kind
+              >> tokenId >> callRule;
+            if (!valid(tokenId) || !valid(callRule))
+                return corrupt();
+            o.p_precedence = precedence;
+            o.p_kind = Operator::Kind(kind);
+            o.p_tokenId = tokenId;
+            o.p_callRule = rules.p_byId[callRule];
+            r->p_operators << o;
         }
-        if (!contained)
+        if (!GrammarData::read(s, r->p_prefixOf)
+                || !GrammarData::read(s, r->p_binaryOf)
+                || !GrammarData::read(s, r->p_syncNames)
+                || !GrammarData::read(s, r->p_sync))
+            return false;
+
+        // the parser indexes these without checks
+        if (r->p_lastRequired >= int(r->p_subRules.size())
+                || (r->p_type == Rule::T_OR && r->p_dispatch.empty())
+                || (r->p_type == Rule::T_OPERATORS && r->p_subRules.empty()))
+            return corrupt();
+        for (const auto& alts : r->p_dispatch)
+            for (int idx : alts)
+                if (idx < 0 || idx >= int(r->p_subRules.size()))
+                    return corrupt();
+        for (const auto* of : { &r->p_prefixOf, &r->p_binaryOf })
+            for (int idx : *of)
+                if (idx >= r->p_operators.size())
+                    return corrupt();
+        return true;
+    };
+    // all rules are in p_byId, not yet all in p_rules
+    auto fail = [&]()
+    {
+        for (size_t i=1; i<rules.p_byId.size(); ++i)
+            delete rules.p_byId[i];
+        rules.p_rules.clear();
+        rules.p_byId.clear();
+        s.setStatus(QDataStream::ReadCorruptData);
+    };
+    for (int id=1; id<numIds; ++id)
+    {
+        Rule* r = rules.p_byId[id];
+        if (!readRule(r) || rules.p_rules.count(r->p_name))
         {
-            p_topRule = i.second;
-            i.second->p_isTop = true;
-            //qDebug() << "toprule" << i.second->toString();
-            break;
+            fail();
+            return s;
         }
+        rules.p_rules.insert(std::make_pair(r->p_name, r));
     }
 
-    p_checked = true;
+    qint32 top;
+    GrammarData::read(s, rules.p_errors);
+    s >> top;
+    if (s.status() != QDataStream::Ok || (top != -1 && !valid(top)))
+    {
+        fail();
+        return s;
+    }
+    rules.p_topRule = top > 0 ? rules.p_byId[top] : nullptr;
+    rules.p_checked = true;
+    return s;
 }
@@ -31,6 +31,7 @@ SOFTWARE.
 #include <map>
 
 #include <QString>
+#include <QStringList>
 #include <QVariant>
 #include <QDebug>
 
@@ -40,10 +41,72 @@ SOFTWARE.
 #define PARSE_ERROR(arg__) { qDebug().noquote().nospace() << arg__; abort(); }
 
 class ParsedToken;
+class Rule;
+class Rules;
+
+QDataStream& operator << (QDataStream& s, const Rules& r);
+QDataStream& operator >> (QDataStream& s, Rules& r);
+
+/** Entry of the operator table of Rules::createOperators() */
+class Operator
+{
+public:
+    enum Kind
+    {
+        /** Binary, left-associative */
+        O_LEFT,
+        /** Binary, right-associative */
+        O_RIGHT,
+        /** Unary, before its operand */
+        O_PREFIX
+    };
+
+    /** Operator @p token with @p precedence, higher binds tighter.
+        The callback of rule @p rule is called for every application
+        with the text from the operator to the end of its right operand,
+        like a rule "op operand" in a cascade of precedence levels. */
+    Operator(const QString& token, int precedence, Kind kind,
+             const QString& rule)
+        : p_token       (token)
+        , p_rule        (rule)
+        , p_precedence  (precedence)
+        , p_kind        (kind)
+        , p_tokenId     (-1)
+        , p_callRule    (nullptr)
+    { }
+
+    const QString& token() const { return p_token; }
+    const QString& rule() const { return p_rule; }
+    int precedence() const { return p_precedence; }
+    Kind kind() const { return p_kind; }
+    bool isPrefix() const { return p_kind == O_PREFIX; }
+
+    /** Symbol id of token(), set by Rules::check() */
+    int tokenId() const { return p_tokenId; }
+    /** The Rule for rule(), set by Rules::check() */
+    const Rule* callRule() const { return p_callRule; }
+
+    /** With @p next following the right operand of this operator,
+        this operator is applied first */
+    bool bindsBefore(const Operator& next) const
+        { return p_precedence > next.p_precedence
+              || (p_precedence == next.p_precedence
+                  && next.p_kind == O_LEFT); }
+
+private:
+    friend class Rules;
+    friend QDataStream& operator >> (QDataStream&, Rules&);
+    QString p_token, p_rule;
+    int p_precedence;
+    Kind p_kind;
+    int p_tokenId;
+    const Rule* p_callRule;
+};
 
 class Rule
 {
-    Rule() : p_isTop(false) { }
+    Rule() : p_id(-1), p_lastRequired(-1), p_nullable(false), p_isTop(false)
+    { }
 
 public:
     typedef std::function<void(const ParsedToken&)> Callback;
@@ -52,7 +115,9 @@ public:
     {
         T_TOKEN,
         T_AND,
-        T_OR
+        T_OR,
+        /** Operands separated by operators, see Rules::createOperators() */
+        T_OPERATORS
     };
 
     struct SubRule
@@ -65,31 +130,85 @@ public:
     };
 
     Type type() const { return p_type; }
+    /** Dense symbol id, assigned by Rules::check() */
+    int id() const { return p_id; }
     const QString& name() const { return p_name; }
     const Token& token() const { return p_token; }
     bool isTop() const { return p_isTop; }
 
-    const QList<SubRule>& subRules() const { return p_subRules; }
+    const std::vector<SubRule>& subRules() const { return p_subRules; }
     bool contains(const QString& name) const;
     bool wants(const QString& name) const;
 
+    /** Rule can succeed without consuming a token,
+        set by Rules::check() */
+    bool isNullable() const { return p_nullable; }
+    /** Terminal symbol @p id is in the FIRST set of the rule,
+        set by Rules::check() */
+    bool canStartWith(int id) const
+        { return id > 0 && id < int(p_first.size()) && p_first[id]; }
+    /** Indices of the subrules of a T_OR rule that can start with
+        terminal symbol @p id, or are nullable, in order */
+    const std::vector<int>& alternatives(int id) const
+        { return p_dispatch[id > 0 && id < int(p_dispatch.size()) ? id : 0]; }
+
     void connect(Callback f) { p_func = f; }
     void connect(int idx, Callback f);
 
+    /** Names of the tokens to skip to when the rule fails,
+        see Rules::setSyncTokens() */
+    const QStringList& syncTokens() const { return p_syncNames; }
+    bool isSync() const { return !p_syncNames.isEmpty(); }
+    /** Terminal symbol @p id is one of syncTokens(),
+        set by Rules::check() */
+    bool isSyncToken(int id) const
+        { return id > 0 && id < int(p_sync.size()) && p_sync[id]; }
+
+    /** Operator table of a T_OPERATORS rule */
+    const QList<Operator>& operators() const { return p_operators; }
+    /** The prefix operator for terminal symbol @p id, or NULL */
+    const Operator* prefixOperator(int id) const
+        { return p_operator(p_prefixOf, id); }
+    /** The binary operator for terminal symbol @p id, or NULL */
+    const Operator* binaryOperator(int id) const
+        { return p_operator(p_binaryOf, id); }
+
     const char* typeName() const {
-        return type() == T_TOKEN ? "TERM" : type() == T_OR ? "OR" : "AND"; }
+        return type() == T_TOKEN ? "TERM" : type() == T_OR ? "OR"
+             : type() == T_OPERATORS ? "OPS" : "AND"; }
 
     QString toString() const { return QString("%1(%2)").arg(name())
                                                        .arg(typeName()); }
     QString toDefinitionString() const;
 
 private:
+    const Operator* p_operator(const std::vector<int>& of, int id) const
+        { return id > 0 && id < int(of.size()) && of[id] >= 0
+                 ? &p_operators[of[id]] : nullptr; }
+
     friend class Rules;
     friend class Parser;
+    friend QDataStream& operator << (QDataStream&, const Rules&);
+    friend QDataStream& operator >> (QDataStream&, Rules&);
     QString p_name;
+    int p_id;
     Type p_type;
     Token p_token;
-    QList<SubRule> p_subRules;
+    std::vector<SubRule> p_subRules;
+    /** Index of the last non-optional subrule, or -1 */
+    int p_lastRequired;
+    /** FIRST set, indexed by terminal symbol id */
+    std::vector<bool> p_first;
+    bool p_nullable;
+    /** alternatives() per terminal symbol id,
+        entry 0 holds the nullable ones for any other symbol */
+    std::vector<std::vector<int>> p_dispatch;
+    QList<Operator> p_operators;
+    /** Index into p_operators per terminal symbol id, or -1 */
+    std::vector<int> p_prefixOf, p_binaryOf;
+    QStringList p_syncNames;
+    /** syncTokens() per terminal symbol id */
+    std::vector<bool> p_sync;
     Callback p_func;
     bool p_isTop;
 };
@@ -98,11 +217,27 @@ private:
 class Rules
 {
 public:
-    Rules() : p_checked(false) { }
-
+    /** Symbol id of the end of input,
+        terminals get 1..numTokens(), other rules follow */
+    enum { ID_EOF = 0 };
+
+    Rules() : p_checked(false), p_topRule(nullptr) { }
+    /** Deep copy, changes to one set do not affect the other */
+    Rules(const Rules& other) : p_checked(false), p_topRule(nullptr)
+        { *this = other; }
+    Rules& operator = (const Rules& other);
+    ~Rules() { p_clear(); }
+
+    /** Returns the rule @p name, or NULL */
     Rule* find(const QString& name);
     Rule* topRule() const { return p_topRule; }
 
+    /** Returns the symbol id of rule @p name, or -1 */
+    int id(const QString& name) const;
+    /** Returns the rule for a symbol id, or NULL for ID_EOF */
+    const Rule* rule(int id) const { return p_byId[id]; }
+    int numIds() const { return p_byId.size(); }
+
     //const std::vector<Rule*>& rules() const { return p_rulesVec; }
     //const std::vector<Rule*>& rulesTerm() const { return p_rulesTerm; }
 
@@ -139,20 +274,58 @@ public:
         { return createOr(name, QStringList()
                            << sym1 << sym2 << sym3 << sym4); }
 
+    /** Creates a rule matching @p operand, optionally preceded by
+        prefix operators, followed by any number of binary operators
+        and operands. Operators are applied by precedence climbing
+        in one loop, instead of one rule per precedence level.
+        For every Operator::rule() that does not exist yet, a T_OR rule
+        of its operator tokens is created, to connect callbacks to. */
+    Rule* createOperators(const QString& name, const QString& operand,
+                          const QList<Operator>& table);
+
     void addTokens(const Tokens&);
 
+    /** Makes rule @p name recover from syntax errors. When it is
+        expected but fails, the parser reports the error, skips the
+        tokens up to and including the next of @p tokens, and goes on
+        as if the rule matched. Where the rule is optional or repeated,
+        a failure only counts as an error if the lookahead can not
+        follow it either. A failing statement then costs only its own
+        tokens, e.g. with "semicolon" for a statement rule.
+        Recovery is done by Parser::E_BACKTRACKING. */
+    void setSyncTokens(const QString& name, const QStringList& tokens);
+
     QString toDefinitionString() const;
+    /** Reads the notation of toDefinitionString(), one rule per line,
+        empty lines and lines starting with # are skipped.
+        Tokens are created as fixed strings, as the notation does not
+        tell them from regexps. Returns empty Rules and the line
+        in @p error if the text is not understood. */
+    static Rules fromDefinitionString(const QString& text,
+                                      QString* error = nullptr);
     void check() { if (!p_checked) p_check(); }
+    /** Problems found by check(), the rules can not be
+        parsed with unless this is empty */
+    const QStringList& errors() const { return p_errors; }
+    bool isValid() const { return p_checked && p_errors.isEmpty(); }
 
     void connect(const QString& name, Rule::Callback f);
     void connect(const QString& name, int idx, Rule::Callback f);
 
 private:
+    friend QDataStream& operator << (QDataStream&, const Rules&);
+    friend QDataStream& operator >> (QDataStream&, Rules&);
+
     static Rule::SubRule makeSubRule(const QString& s);
     void p_add(Rule*);
+    void p_clear();
     void p_check();
+    void p_computeFirst();
+    void p_error(const QString& e);
     bool p_checked;
+    QStringList p_errors;
     std::map<QString, Rule*> p_rules;
+    std::vector<Rule*> p_byId;
     Rule* p_topRule;
     //std::vector<Rule*> p_rulesVec, p_rulesTerm;
 };
@@ -0,0 +1,229 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <atomic>
+#include <cstring>
+
+#include "Scanner.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) \
+    && (defined(__x86_64__) || defined(__i386__))
+#   define SYNTAK_X86_SIMD
+#   include <immintrin.h>
+#endif
+
+namespace
+{
+    typedef int (*SkipFunc)(const ushort*, int, int, int*);
+    typedef bool (*EqualFunc)(const ushort*, const ushort*, int);
+
+    bool isAsciiSpace(ushort c) { return c == ' ' || (c >= 9 && c <= 13); }
+
+    int skipSpaceScalar(const ushort* s, int pos, int end, int* lines)
+    {
+        for (; pos < end && isAsciiSpace(s[pos]); ++pos)
+            if (s[pos] == '\n')
+                ++*lines;
+        return pos;
+    }
+
+    bool equalScalar(const ushort* a, const ushort* b, int len)
+    {
+        return std::memcmp(a, b, len * sizeof(ushort)) == 0;
+    }
+
+#ifdef SYNTAK_X86_SIMD
+
+    /* Both variants classify a block of characters with
+       (c == ' ') | ((c - 9) <= 4 unsigned), take the byte mask and
+       count newlines in the whitespace prefix of the block.
+       The byte masks have two bits per character. */
+
+    __attribute__((target("sse2")))
+    int skipSpaceSse2(const ushort* s, int pos, int end, int* lines)
+    {
+        const __m128i space = _mm_set1_epi16(' '),
+                      tab = _mm_set1_epi16(9),
+                      four = _mm_set1_epi16(4),
+                      nl = _mm_set1_epi16('\n'),
+                      zero = _mm_setzero_si128();
+        for (; pos + 8 <= end; pos += 8)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + pos));
+            __m128i ctl = _mm_cmpeq_epi16(
+                        _mm_subs_epu16(_mm_sub_epi16(v, tab), four), zero);
+            unsigned ws = _mm_movemask_epi8(
+                        _mm_or_si128(ctl, _mm_cmpeq_epi16(v, space)));
+            unsigned nls = _mm_movemask_epi8(_mm_cmpeq_epi16(v, nl));
+            if (ws != 0xffff)
+            {
+                int n = __builtin_ctz(~ws) / 2;
+                *lines += __builtin_popcount(nls & ((1u << (n * 2)) - 1)) / 2;
+                return pos + n;
+            }
+            *lines += __builtin_popcount(nls) / 2;
+        }
+        return skipSpaceScalar(s, pos, end, lines);
+    }
+
+    __attribute__((target("sse2")))
+    bool equalSse2(const ushort* a, const ushort* b, int len)
+    {
+        int i = 0;
+        for (; i + 8 <= len; i += 8)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i)),
+                    vb = _mm_loadu_si128((const __m128i*)(b + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(va, vb)) != 0xffff)
+                return false;
+        }
+        return equalScalar(a + i, b + i, len - i);
+    }
+
+    __attribute__((target("avx2")))
+    int skipSpaceAvx2(const ushort* s, int pos, int end, int* lines)
+    {
+        const __m256i space = _mm256_set1_epi16(' '),
+                      tab = _mm256_set1_epi16(9),
+                      four = _mm256_set1_epi16(4),
+                      nl = _mm256_set1_epi16('\n'),
+                      zero = _mm256_setzero_si256();
+        for (; pos + 16 <= end; pos += 16)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(s + pos));
+            __m256i ctl = _mm256_cmpeq_epi16(
+                    _mm256_subs_epu16(_mm256_sub_epi16(v, tab), four), zero);
+            unsigned ws = _mm256_movemask_epi8(
+                    _mm256_or_si256(ctl, _mm256_cmpeq_epi16(v, space)));
+            unsigned nls = _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, nl));
+            if (ws != 0xffffffffu)
+            {
+                int n = __builtin_ctz(~ws) / 2;
+                unsigned below = n ? (~0u >> (32 - n * 2)) : 0;
+                *lines += __builtin_popcount(nls & below) / 2;
+                return pos + n;
+            }
+            *lines += __builtin_popcount(nls) / 2;
+        }
+        return skipSpaceSse2(s, pos, end, lines);
+    }
+
+    __attribute__((target("avx2")))
+    bool equalAvx2(const ushort* a, const ushort* b, int len)
+    {
+        int i = 0;
+        for (; i + 16 <= len; i += 16)
+        {
+            __m256i va = _mm256_loadu_si256((const __m256i*)(a + i)),
+                    vb = _mm256_loadu_si256((const __m256i*)(b + i));
+            if (unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi16(va, vb)))
+                    != 0xffffffffu)
+                return false;
+        }
+        return equalSse2(a + i, b + i, len - i);
+    }
+
+#endif // SYNTAK_X86_SIMD
+
+    struct Dispatch
+    {
+        Dispatch() { set(best()); }
+
+        static Scanner::Isa best()
+        {
+#ifdef SYNTAK_X86_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return Scanner::I_AVX2;
+            if (__builtin_cpu_supports("sse2"))
+                return Scanner::I_SSE2;
+#endif
+            return Scanner::I_SCALAR;
+        }
+
+        void set(Scanner::Isa i)
+        {
+            SkipFunc s = skipSpaceScalar;
+            EqualFunc e = equalScalar;
+            switch (i)
+            {
+#ifdef SYNTAK_X86_SIMD
+                case Scanner::I_AVX2:
+                    s = skipSpaceAvx2; e = equalAvx2; break;
+                case Scanner::I_SSE2:
+                    s = skipSpaceSse2; e = equalSse2; break;
+#endif
+                default:
+                    break;
+            }
+            // every variant gives the same results, so a lexxer in
+            // another thread may mix them while they are replaced
+            skip.store(s, std::memory_order_relaxed);
+            equal.store(e, std::memory_order_relaxed);
+            isa.store(i, std::memory_order_relaxed);
+        }
+
+        std::atomic<Scanner::Isa> isa;
+        std::atomic<SkipFunc> skip;
+        std::atomic<EqualFunc> equal;
+    };
+
+    Dispatch& dispatch()
+    {
+        static Dispatch d;
+        return d;
+    }
+
+} // namespace
+
+
+Scanner::Isa Scanner::isa()
+{
+    return dispatch().isa.load(std::memory_order_relaxed);
+}
+
+bool Scanner::isSupported(Isa i) { return i <= Dispatch::best(); }
+
+bool Scanner::setIsa(Isa i)
+{
+    if (!isSupported(i))
+        return false;
+    dispatch().set(i);
+    return true;
+}
+
+int Scanner::skipSpace(const QChar* s, int pos, int end, int* lines)
+{
+    return dispatch().skip.load(std::memory_order_relaxed)(
+                reinterpret_cast<const ushort*>(s), pos, end, lines);
+}
+
+bool Scanner::equal(const QChar* a, const QChar* b, int len)
+{
+    return dispatch().equal.load(std::memory_order_relaxed)(
+                reinterpret_cast<const ushort*>(a),
+                reinterpret_cast<const ushort*>(b), len);
+}
@@ -0,0 +1,62 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef SCANNER_H
+#define SCANNER_H
+
+#include <QChar>
+
+/** Bulk character routines for the lexxer over UTF-16 data.
+
+    The implementation is chosen once at startup from the cpu features
+    (AVX2, SSE2 or plain C++). All variants give identical results. */
+class Scanner
+{
+public:
+    enum Isa
+    {
+        I_SCALAR,
+        I_SSE2,
+        I_AVX2
+    };
+
+    static Isa isa();
+    static bool isSupported(Isa);
+    /** Selects an implementation, returns false if not supported.
+        May be called while other threads lex, they switch over
+        at their next call. */
+    static bool setIsa(Isa);
+
+    /** Returns the index of the first character in [pos, end) that
+        is not ascii whitespace (tab, newline, vt, ff, cr, space),
+        or @p end. The number of skipped newlines is added to @p lines. */
+    static int skipSpace(const QChar* s, int pos, int end, int* lines);
+
+    /** Returns true if the @p len characters at @p a and @p b are equal */
+    static bool equal(const QChar* a, const QChar* b, int len);
+};
+
+#endif // SCANNER_H
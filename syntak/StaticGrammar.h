@@ -0,0 +1,592 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef STATICGRAMMAR_H
+#define STATICGRAMMAR_H
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <type_traits>
+#include <vector>
+
+#include <QStringList>
+#include <QDebug>
+
+#include "Tokens.h"
+#include "Rules.h"
+#include "CompiledGrammar.h"
+#include "Parser.h"
+
+/** A grammar written as C++ types, parsed by code the compiler
+    generates for each rule.
+
+    The vocabulary mirrors Rules:
+    @code
+    SYNTAK_TOKEN(plus);                         // Token named "plus"
+    struct expr;                                // for recursion
+    SYNTAK_RULE(op1, Or<plus, minus>);          // createOr()
+    SYNTAK_RULE(sum, And<expr, op1, expr>);     // createAnd()
+    And<a, Opt<b>>                              // "a", "[b]"
+    And<Repeat<a>, Opt<Repeat<b>>>              // "a*", "[b]*"
+    @endcode
+    Tokens are looked up by Token::name() in the lexxer when the
+    Parser is constructed, see Parser::errors(). Rules are tried like
+    the backtracking engine of ::Parser does, without memo, recovery
+    or left recursion.
+
+    Actions are a class passed to Parser as template parameter,
+    with overloads for the rules they handle, called right away:
+    @code
+    void operator()(assignment, const ParsedToken&);
+    void operator()(assignment, Sub<0>, const ParsedToken&);
+    @endcode
+    The first is the callback of a rule, the second of its subrule 0,
+    see Rules::connect(). Rules without an overload cost nothing.
+    The Callbacks actions instead call the Rule::Callback functions
+    connected to them by rule name. */
+namespace StaticGrammar
+{
+
+/** Tag of subrule @p I in an action */
+template <int I> struct Sub { };
+
+/** Index per rule type, for the caches of Parser and Callbacks */
+inline size_t nextRuleIndex()
+    { static std::atomic<size_t> next(0); return next++; }
+template <class R>
+size_t ruleIndex()
+    { static const size_t index = nextRuleIndex(); return index; }
+
+/** R has a static name(), see SYNTAK_RULE() and SYNTAK_TOKEN() */
+template <class R>
+struct HasName
+{
+    template <class T> static char test(decltype(T::name())*);
+    template <class T> static long test(...);
+    enum { value = sizeof(test<R>(nullptr)) == 1 };
+};
+
+/** Actions A can be called with Args */
+template <class A, class... Args>
+struct HasAction
+{
+    template <class T> static char
+        test(decltype(std::declval<T&>()(std::declval<Args>()...))*);
+    template <class T> static long test(...);
+    enum { value = sizeof(test<A>(nullptr)) == 1 };
+};
+
+/** Reports a match of subrule @p I of rule @p Parent,
+    nothing for Parent void */
+template <class Parent, int I>
+struct SubEmit
+{
+    template <class R, class P>
+    void emit(P& p, size_t from) const
+        { p.template emitSub<Parent, I, R>(from); }
+};
+
+template <int I>
+struct SubEmit<void, I>
+{
+    template <class R, class P>
+    void emit(P&, size_t) const { }
+};
+
+typedef SubEmit<void, 0> NoEmit;
+
+/** Calls resolve() of each of R... */
+template <class... R>
+struct Each
+{
+    template <class P>
+    static void resolve(P&) { }
+};
+
+template <class R, class... Rest>
+struct Each<R, Rest...>
+{
+    template <class P>
+    static void resolve(P& p)
+        { R::resolve(p); Each<Rest...>::resolve(p); }
+};
+
+/** Token named by Self, see SYNTAK_TOKEN() */
+template <class Self>
+struct Tok
+{
+    template <class P>
+    static void resolve(P& p) { p.template resolveToken<Self>(); }
+
+    template <class P, class E>
+    static bool parse(P& p, const E& e)
+    {
+        if (p.kind() != p.template tokenKind<Self>())
+            return false;
+        const size_t from = p.pos();
+        p.next();
+        e.template emit<Self>(p, from);
+        p.template emitRule<Self>(from);
+        return true;
+    }
+};
+
+/** Subrules R... in order, as subrules @p I and following */
+template <class Parent, int I, class... R>
+struct Seq
+{
+    template <class P>
+    static bool parse(P&) { return true; }
+};
+
+template <class Parent, int I, class R, class... Rest>
+struct Seq<Parent, I, R, Rest...>
+{
+    template <class P>
+    static bool parse(P& p)
+    {
+        return R::parse(p, SubEmit<Parent, I>())
+            && Seq<Parent, I + 1, Rest...>::parse(p);
+    }
+};
+
+/** The first matching of R..., as subrules @p I and following */
+template <class Parent, int I, class... R>
+struct Alt
+{
+    template <class P>
+    static bool parse(P&) { return false; }
+};
+
+template <class Parent, int I, class R, class... Rest>
+struct Alt<Parent, I, R, Rest...>
+{
+    template <class P>
+    static bool parse(P& p)
+    {
+        return R::parse(p, SubEmit<Parent, I>())
+            || Alt<Parent, I + 1, Rest...>::parse(p);
+    }
+};
+
+/** All of R... in order, like Rules::createAnd() */
+template <class... R>
+struct And
+{
+    template <class P>
+    static void resolve(P& p) { Each<R...>::resolve(p); }
+
+    template <class Parent, class P>
+    static bool parseBody(P& p)
+    {
+        const size_t from = p.pos();
+        if (Seq<Parent, 0, R...>::parse(p))
+            return true;
+        p.setPos(from);
+        return false;
+    }
+
+    template <class P, class E>
+    static bool parse(P& p, const E& e)
+    {
+        const size_t from = p.pos();
+        if (!parseBody<void>(p))
+            return false;
+        e.template emit<And>(p, from);
+        return true;
+    }
+};
+
+/** The first matching of R..., like Rules::createOr() */
+template <class... R>
+struct Or
+{
+    template <class P>
+    static void resolve(P& p) { Each<R...>::resolve(p); }
+
+    template <class Parent, class P>
+    static bool parseBody(P& p) { return Alt<Parent, 0, R...>::parse(p); }
+
+    template <class P, class E>
+    static bool parse(P& p, const E& e)
+    {
+        const size_t from = p.pos();
+        if (!parseBody<void>(p))
+            return false;
+        e.template emit<Or>(p, from);
+        return true;
+    }
+};
+
+/** R or nothing, like "[r]" */
+template <class R>
+struct Opt
+{
+    template <class P>
+    static void resolve(P& p) { R::resolve(p); }
+
+    template <class P, class E>
+    static bool parse(P& p, const E& e) { R::parse(p, e); return true; }
+};
+
+/** R once or more, like "r*" */
+template <class R>
+struct Repeat
+{
+    template <class P>
+    static void resolve(P& p) { R::resolve(p); }
+
+    template <class P, class E>
+    static bool parse(P& p, const E& e)
+    {
+        if (!R::parse(p, e))
+            return false;
+        size_t pos = p.pos();
+        while (R::parse(p, e) && p.pos() != pos)
+            pos = p.pos();
+        return true;
+    }
+};
+
+/** Subrules of a rule with body @p B, the subrules of
+    And and Or and otherwise B itself */
+template <class B>
+struct Body
+{
+    template <class Parent, class P>
+    static bool parse(P& p) { return Seq<Parent, 0, B>::parse(p); }
+};
+
+template <class... R>
+struct Body<And<R...>>
+{
+    template <class Parent, class P>
+    static bool parse(P& p)
+        { return And<R...>::template parseBody<Parent>(p); }
+};
+
+template <class... R>
+struct Body<Or<R...>>
+{
+    template <class Parent, class P>
+    static bool parse(P& p)
+        { return Or<R...>::template parseBody<Parent>(p); }
+};
+
+/** A rule with actions, named by Self, see SYNTAK_RULE() */
+template <class Self, class B>
+struct NamedRule
+{
+    template <class P>
+    static void resolve(P& p)
+    {
+        if (p.template visit<Self>())
+            B::resolve(p);
+    }
+
+    template <class P, class E>
+    static bool parse(P& p, const E& e)
+    {
+        const size_t from = p.pos();
+        if (!Body<B>::template parse<Self>(p))
+            return false;
+        e.template emit<Self>(p, from);
+        p.template emitRule<Self>(from);
+        return true;
+    }
+};
+
+
+/** Actions calling the Rule::Callback functions connected by name,
+    with the same signatures as ::Parser::connect() */
+class Callbacks
+{
+public:
+    void connect(const QString& name, ::Rule::Callback f)
+        { connect(name, -1, f); }
+    void connect(const QString& name, int idx, ::Rule::Callback f)
+    {
+        Connection c = { name, idx, f };
+        p_connections.push_back(c);
+        p_slots.clear();
+    }
+
+    template <class R>
+    void operator()(R, const ParsedToken& t)
+    {
+        const Slot& s = p_slot<R>();
+        if (s.func)
+            (*s.func)(t);
+    }
+
+    template <class R, int I>
+    void operator()(R, Sub<I>, const ParsedToken& t)
+    {
+        const Slot& s = p_slot<R>();
+        if (size_t(I) < s.subFuncs.size() && s.subFuncs[I])
+            (*s.subFuncs[I])(t);
+    }
+
+private:
+    struct Connection
+    {
+        QString name;
+        int idx;
+        ::Rule::Callback func;
+    };
+    /** Callbacks of a rule type, looked up on first use */
+    struct Slot
+    {
+        Slot() : resolved(false), func(nullptr) { }
+        bool resolved;
+        const ::Rule::Callback* func;
+        std::vector<const ::Rule::Callback*> subFuncs;
+    };
+
+    template <class R>
+    const Slot& p_slot()
+    {
+        const size_t i = ruleIndex<R>();
+        if (i >= p_slots.size())
+            p_slots.resize(i + 1);
+        Slot& s = p_slots[i];
+        if (!s.resolved)
+        {
+            s.resolved = true;
+            for (const Connection& c : p_connections)
+            if (c.name == R::name())
+            {
+                if (c.idx < 0)
+                    s.func = &c.func;
+                else
+                {
+                    if (size_t(c.idx) >= s.subFuncs.size())
+                        s.subFuncs.resize(c.idx + 1, nullptr);
+                    s.subFuncs[c.idx] = &c.func;
+                }
+            }
+        }
+        return s;
+    }
+
+    std::vector<Connection> p_connections;
+    std::vector<Slot> p_slots;
+};
+
+
+/** Parses with the grammar of rule @p Top and calls @p Actions.
+
+    Lexxes with Tokens like ::Parser, the kinds of the tokens of the
+    grammar are looked up by name on construction. With a
+    CompiledGrammar the ParsedToken::rule() of the actions is the Rule
+    of the same name, otherwise NULL. */
+template <class Top, class Actions = Callbacks>
+class Parser
+{
+public:
+    explicit Parser(const Tokens& lexxer)
+        : p_lexxer(lexxer), p_rules(nullptr), p_pos(0)
+        { p_init(); }
+    explicit Parser(std::shared_ptr<const CompiledGrammar> grammar)
+        : p_grammar(grammar), p_lexxer(grammar->lexxer())
+        , p_rules(&grammar->rules()), p_pos(0)
+        { p_init(); }
+
+    /** Tokens of the grammar that the lexxer does not define,
+        parse() fails if not empty */
+    const QStringList& errors() const { return p_errors; }
+
+    Actions& actions() { return p_actions; }
+    const Actions& actions() const { return p_actions; }
+
+    /** Lexxes and parses @p text, returns true if Top matched
+        all of it. The token buffer of the last parse is reused. */
+    bool parse(const QString& text)
+    {
+        if (!p_errors.isEmpty())
+            return false;
+        p_text = text;
+        p_tokens.clear();
+        p_lexxer.tokenize(p_text, p_tokens);
+        p_pos = 0;
+        return Top::parse(*this, NoEmit()) && kind() == Tokens::K_EOF;
+    }
+
+    const QString& text() const { return p_text; }
+    const std::vector<LexxedToken>& lexxedTokens() const { return p_tokens; }
+
+    // --- used by the rules ---
+
+    const LexxedToken& curToken() const { return p_tokens[p_pos]; }
+    int kind() const { return p_tokens[p_pos].kind(); }
+    size_t pos() const { return p_pos; }
+    /** Moves behind curToken(), which is not the K_EOF token */
+    void next() { ++p_pos; }
+    void setPos(size_t pos) { p_pos = pos; }
+
+    /** LexxedToken::kind() of token @p T, or -1 */
+    template <class T>
+    int tokenKind() const { return p_kinds[ruleIndex<T>()]; }
+
+    /** Marks rule @p R as seen, returns false if it was already */
+    template <class R>
+    bool visit()
+    {
+        const size_t i = ruleIndex<R>();
+        if (i >= p_kinds.size())
+            p_kinds.resize(i + 1, P_UNSEEN);
+        if (p_kinds[i] != P_UNSEEN)
+            return false;
+        p_kinds[i] = P_RULE;
+        return true;
+    }
+
+    /** Sets tokenKind() of @p T to the Token of the same name */
+    template <class T>
+    void resolveToken()
+    {
+        const size_t i = ruleIndex<T>();
+        if (i >= p_kinds.size())
+            p_kinds.resize(i + 1, P_UNSEEN);
+        if (p_kinds[i] != P_UNSEEN)
+            return;
+        const std::vector<Token>& tokens = p_lexxer.tokens();
+        for (size_t k = 0; k < tokens.size(); ++k)
+            if (tokens[k].name() == T::name())
+            {
+                p_kinds[i] = k + 1;
+                return;
+            }
+        // never matches
+        p_kinds[i] = -1;
+        p_errors << QString("token '%1' not in the lexxer").arg(T::name());
+        qWarning() << "StaticGrammar:" << p_errors.back();
+    }
+
+    /** Calls the action of rule @p R, matched from token @p from */
+    template <class R>
+    void emitRule(size_t from)
+    {
+        p_emitRule<R>(from, std::integral_constant<bool,
+                      HasAction<Actions, R, const ParsedToken&>::value>());
+    }
+
+    /** Calls the action of subrule @p I of @p Parent,
+        which is rule @p R matched from token @p from */
+    template <class Parent, int I, class R>
+    void emitSub(size_t from)
+    {
+        p_emitSub<Parent, I, R>(from, std::integral_constant<bool,
+                  HasAction<Actions, Parent, Sub<I>,
+                            const ParsedToken&>::value>());
+    }
+
+private:
+    /** p_kinds of types not resolved yet, and of rules */
+    enum { P_UNSEEN = -2, P_RULE = 0 };
+
+    void p_init()
+    {
+        p_lexxer.prepare();
+        Top::resolve(*this);
+    }
+
+    template <class R>
+    void p_emitRule(size_t, std::false_type) { }
+    template <class R>
+    void p_emitRule(size_t from, std::true_type)
+        { p_actions(R(), p_parsedToken<R>(from)); }
+
+    template <class Parent, int I, class R>
+    void p_emitSub(size_t, std::false_type) { }
+    template <class Parent, int I, class R>
+    void p_emitSub(size_t from, std::true_type)
+        { p_actions(Parent(), Sub<I>(), p_parsedToken<R>(from)); }
+
+    /** Text of rule @p R from token @p from to the last token
+        before the current one */
+    template <class R>
+    ParsedToken p_parsedToken(size_t from)
+    {
+        const LexxedToken& first = p_tokens[from];
+        int len = 0;
+        if (p_pos > from)
+        {
+            const LexxedToken& last = p_tokens[p_pos - 1];
+            len = last.pos().pos() + last.length() - first.pos().pos();
+        }
+        return ParsedToken(p_text, first.pos(), len,
+            p_rule<R>(std::integral_constant<bool, HasName<R>::value>()));
+    }
+
+    template <class R>
+    const ::Rule* p_rule(std::false_type) { return nullptr; }
+    template <class R>
+    const ::Rule* p_rule(std::true_type)
+    {
+        if (!p_rules)
+            return nullptr;
+        const size_t i = ruleIndex<R>();
+        if (i >= p_ruleOf.size())
+            p_ruleOf.resize(i + 1, std::make_pair(false, nullptr));
+        auto& r = p_ruleOf[i];
+        if (!r.first)
+        {
+            const int id = p_rules->id(R::name());
+            r = std::make_pair(true, id >= 0 ? p_rules->rule(id) : nullptr);
+        }
+        return r.second;
+    }
+
+    std::shared_ptr<const CompiledGrammar> p_grammar;
+    Tokens p_lexxer;
+    const Rules* p_rules;
+    Actions p_actions;
+    QString p_text;
+    std::vector<LexxedToken> p_tokens;
+    size_t p_pos;
+    /** Rule per ruleIndex(), looked up on first use */
+    std::vector<std::pair<bool, const ::Rule*>> p_ruleOf;
+    /** Token kind per ruleIndex(), -1 for unknown tokens */
+    std::vector<int> p_kinds;
+    QStringList p_errors;
+};
+
+} // namespace StaticGrammar
+
+
+/** Defines token @p name__, the Token of that name in the lexxer */
+#define SYNTAK_TOKEN(name__) \
+    struct name__ : StaticGrammar::Tok<name__> \
+        { static const char* name() { return #name__; } }
+
+/** Defines rule @p name__ with the body in the remaining arguments */
+#define SYNTAK_RULE(name__, ...) \
+    struct name__ : StaticGrammar::NamedRule<name__, __VA_ARGS__> \
+        { static const char* name() { return #name__; } }
+
+#endif // STATICGRAMMAR_H
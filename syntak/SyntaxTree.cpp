@@ -0,0 +1,154 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include "SyntaxTree.h"
+#include "Rules.h"
+
+int SyntaxTree::numChildren(int i) const
+{
+    int n = 0;
+    for (int c = p_nodes[i].firstChild; c != NO_NODE;
+         c = p_nodes[c].nextSibling)
+        ++n;
+    return n;
+}
+
+void SyntaxTree::clear()
+{
+    p_nodes.clear();
+    p_stack.clear();
+}
+
+QString SyntaxTree::toString(const Rules& rules, int i) const
+{
+    if (i < 0 || i >= size())
+        return QString();
+    const Node& n = p_nodes[i];
+    QString s = rules.rule(n.rule)->name();
+    if (rules.rule(n.rule)->type() == Rule::T_TOKEN)
+        return s;
+    s += "(";
+    for (int c = n.firstChild; c != NO_NODE; c = p_nodes[c].nextSibling)
+    {
+        if (c != n.firstChild)
+            s += " ";
+        s += toString(rules, c);
+    }
+    return s + ")";
+}
+
+int SyntaxTree::p_open(int id, int begin)
+{
+    Node n;
+    n.rule = id;
+    n.begin = n.end = begin;
+    n.firstChild = n.nextSibling = NO_NODE;
+    p_nodes.push_back(n);
+
+    Open o;
+    o.node = p_nodes.size() - 1;
+    o.lastChild = NO_NODE;
+    p_stack.push_back(o);
+    return o.node;
+}
+
+void SyntaxTree::p_close(int end)
+{
+    const int i = p_stack.back().node;
+    p_stack.pop_back();
+    p_nodes[i].end = end;
+    p_link(i);
+}
+
+void SyntaxTree::p_fail()
+{
+    const int i = p_stack.back().node;
+    p_stack.pop_back();
+    // nothing links to it yet
+    if (!p_keep)
+        p_nodes.resize(i);
+}
+
+void SyntaxTree::p_leaf(int id, int begin)
+{
+    p_open(id, begin);
+    p_close(begin + 1);
+}
+
+void SyntaxTree::p_copy(const SyntaxTree& from, int begin, int end,
+                        int shift)
+{
+    const int offset = p_nodes.size() - begin;
+    for (int i = begin; i < end; ++i)
+    {
+        // from may be this tree
+        Node n = from.p_nodes[i];
+        n.begin += shift;
+        n.end += shift;
+        if (n.firstChild != NO_NODE)
+            n.firstChild += offset;
+        if (n.nextSibling != NO_NODE)
+            n.nextSibling += offset;
+        p_nodes.push_back(n);
+    }
+    p_nodes[begin + offset].nextSibling = NO_NODE;
+    p_link(begin + offset);
+}
+
+void SyntaxTree::p_cut(int size)
+{
+    Open& o = p_stack.back();
+    if (o.lastChild >= size)
+    {
+        // children are in ascending order
+        Node& parent = p_nodes[o.node];
+        if (parent.firstChild >= size)
+            parent.firstChild = o.lastChild = NO_NODE;
+        else
+        {
+            int c = parent.firstChild;
+            while (p_nodes[c].nextSibling != NO_NODE
+                   && p_nodes[c].nextSibling < size)
+                c = p_nodes[c].nextSibling;
+            p_nodes[c].nextSibling = NO_NODE;
+            o.lastChild = c;
+        }
+    }
+    if (!p_keep && size < this->size())
+        p_nodes.resize(size);
+}
+
+void SyntaxTree::p_link(int i)
+{
+    if (p_stack.empty())
+        return;
+    Open& o = p_stack.back();
+    if (o.lastChild == NO_NODE)
+        p_nodes[o.node].firstChild = i;
+    else
+        p_nodes[o.lastChild].nextSibling = i;
+    o.lastChild = i;
+}
@@ -0,0 +1,106 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef SYNTAXTREE_H
+#define SYNTAXTREE_H
+
+#include <vector>
+
+#include <QString>
+
+class Rules;
+
+/** Concrete syntax tree of a parse, see Parser::setBuildTree().
+
+    All nodes live in one array, linked by index to their first child
+    and next sibling. Every matched rule and token is a node, in the
+    order the parser entered them, the root is node 0.
+    Operands and operator tokens of a T_OPERATORS rule are its
+    children in text order, the precedence is only seen by callbacks.
+    clear() keeps the memory, so the next parse reuses it. */
+class SyntaxTree
+{
+public:
+    enum { NO_NODE = -1 };
+
+    struct Node
+    {
+        /** Rules symbol id */
+        qint32 rule;
+        /** Token indices of the match, end is exclusive */
+        qint32 begin, end;
+        /** Node indices, or NO_NODE */
+        qint32 firstChild, nextSibling;
+    };
+
+    SyntaxTree() : p_keep(false) { }
+
+    bool isEmpty() const { return p_nodes.empty(); }
+    /** Number of nodes, including unlinked ones of failed rules
+        in packrat mode */
+    int size() const { return p_nodes.size(); }
+    const Node& node(int i) const { return p_nodes[i]; }
+    int root() const { return isEmpty() ? NO_NODE : 0; }
+
+    int numChildren(int i) const;
+
+    /** Removes all nodes, keeps the memory */
+    void clear();
+
+    /** Nodes in the form name(child child ...) starting at @p i,
+        tokens are written without brackets */
+    QString toString(const Rules& rules, int i = 0) const;
+
+private:
+    friend class Parser;
+
+    /** Appends a node for rule @p id starting at token @p begin
+        as the last child of the innermost open node and opens it.
+        With @p keep, failed nodes are unlinked but stay in memory. */
+    int p_open(int id, int begin);
+    void p_close(int end);
+    /** Closes and removes the innermost open node */
+    void p_fail();
+    /** Appends a closed node without children */
+    void p_leaf(int id, int begin);
+    /** Appends a copy of the closed subtree in nodes [@p begin, @p end)
+        for a result that was parsed before */
+    void p_copy(int begin, int end) { p_copy(*this, begin, end, 0); }
+    /** Same for nodes of @p from, token indices moved by @p shift */
+    void p_copy(const SyntaxTree& from, int begin, int end, int shift);
+    /** Removes the children of the innermost open node
+        from node @p size on */
+    void p_cut(int size);
+    void p_link(int i);
+
+    std::vector<Node> p_nodes;
+    struct Open { qint32 node, lastChild; };
+    /** Nodes not closed yet, innermost last */
+    std::vector<Open> p_stack;
+    bool p_keep;
+};
+
+#endif // SYNTAXTREE_H
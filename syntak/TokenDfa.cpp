@@ -0,0 +1,749 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <map>
+#include <algorithm>
+
+#include "TokenDfa.h"
+#include "GrammarData.h"
+
+namespace
+{
+    /** sorted, non-overlapping list of inclusive character ranges */
+    typedef std::vector<std::pair<int, int>> RangeSet;
+
+    void normalize(RangeSet& r)
+    {
+        std::sort(r.begin(), r.end());
+        RangeSet o;
+        for (auto& i : r)
+            if (!o.empty() && i.first <= o.back().second + 1)
+                o.back().second = std::max(o.back().second, i.second);
+            else
+                o.push_back(i);
+        r.swap(o);
+    }
+
+    RangeSet inverted(const RangeSet& r)
+    {
+        RangeSet o;
+        int lo = 0;
+        for (auto& i : r)
+        {
+            if (i.first > lo)
+                o.push_back(std::make_pair(lo, i.first - 1));
+            lo = i.second + 1;
+        }
+        if (lo <= 0xffff)
+            o.push_back(std::make_pair(lo, 0xffff));
+        return o;
+    }
+
+    bool contains(const RangeSet& r, int c)
+    {
+        for (auto& i : r)
+            if (c >= i.first && c <= i.second)
+                return true;
+        return false;
+    }
+
+    template <class Pred>
+    RangeSet predicateSet(Pred pred)
+    {
+        RangeSet r;
+        for (int c=0; c<=0xffff; ++c)
+            if (pred(QChar(c)))
+                r.push_back(std::make_pair(c, c));
+        normalize(r);
+        return r;
+    }
+
+    /** Character classes with the same meaning as in QRegExp */
+    const RangeSet* charClass(ushort c)
+    {
+        static const RangeSet
+            digit = predicateSet([](QChar c) { return c.isDigit(); }),
+            space = predicateSet([](QChar c) { return c.isSpace(); }),
+            word = predicateSet([](QChar c)
+                { return c.isLetterOrNumber() || c.isMark() || c == '_'; }),
+            noDigit = inverted(digit),
+            noSpace = inverted(space),
+            noWord = inverted(word);
+
+        switch (c)
+        {
+            case 'd': return &digit;
+            case 'D': return &noDigit;
+            case 's': return &space;
+            case 'S': return &noSpace;
+            case 'w': return &word;
+            case 'W': return &noWord;
+        }
+        return nullptr;
+    }
+
+    struct RegNode
+    {
+        enum Type { N_SET, N_CAT, N_ALT, N_REP };
+        Type type;
+        RangeSet set;
+        std::vector<RegNode> nodes;
+        int min, max;
+
+        RegNode(Type t = N_CAT) : type(t), min(1), max(1) { }
+    };
+
+    /** Recursive descent parser for the supported QRegExp subset */
+    class RegParser
+    {
+    public:
+        RegParser(const QString& p) : s(p), i(0), ok(true) { }
+
+        bool parse(RegNode* n)
+        {
+            *n = parseAlt();
+            return ok && i == s.size();
+        }
+
+    private:
+        bool atEnd() const { return i >= s.size(); }
+        ushort peek() const { return s[i].unicode(); }
+
+        RegNode parseAlt()
+        {
+            RegNode n(RegNode::N_ALT);
+            n.nodes.push_back(parseCat());
+            while (ok && !atEnd() && peek() == '|')
+            {
+                ++i;
+                n.nodes.push_back(parseCat());
+            }
+            if (n.nodes.size() == 1)
+                return n.nodes[0];
+            return n;
+        }
+
+        RegNode parseCat()
+        {
+            RegNode n(RegNode::N_CAT);
+            while (ok && !atEnd() && peek() != '|' && peek() != ')')
+                n.nodes.push_back(parseRep());
+            return n;
+        }
+
+        RegNode parseRep()
+        {
+            RegNode n = parseAtom();
+            while (ok && !atEnd())
+            {
+                int mi, ma;
+                switch (peek())
+                {
+                    case '*': mi = 0; ma = -1; ++i; break;
+                    case '+': mi = 1; ma = -1; ++i; break;
+                    case '?': mi = 0; ma = 1; ++i; break;
+                    case '{':
+                        ++i;
+                        mi = ma = parseInt();
+                        if (!atEnd() && peek() == ',')
+                        {
+                            ++i;
+                            ma = (!atEnd() && peek() == '}') ? -1 : parseInt();
+                        }
+                        if (atEnd() || peek() != '}')
+                            ok = false;
+                        ++i;
+                    break;
+                    default: return n;
+                }
+                // no lazy or possessive quantifiers,
+                // keep the unrolled automaton small
+                if ((!atEnd() && (peek() == '?' || peek() == '+'))
+                    || (ma >= 0 && ma < mi) || mi > 64 || ma > 64)
+                    ok = false;
+
+                RegNode r(RegNode::N_REP);
+                r.nodes.push_back(n);
+                r.min = mi;
+                r.max = ma;
+                n = r;
+            }
+            return n;
+        }
+
+        RegNode parseAtom()
+        {
+            RegNode n(RegNode::N_SET);
+            ushort c = peek();
+            switch (c)
+            {
+                case '(':
+                    ++i;
+                    if (!atEnd() && peek() == '?')
+                    {
+                        if (i+1 < s.size() && s[i+1] == ':')
+                            i += 2;
+                        else
+                            ok = false;
+                    }
+                    n = parseAlt();
+                    if (atEnd() || peek() != ')')
+                        ok = false;
+                    ++i;
+                break;
+
+                case '[':
+                    n.set = parseClass();
+                break;
+
+                case '.':
+                    ++i;
+                    n.set.push_back(std::make_pair(0, 0xffff));
+                break;
+
+                case '\\':
+                    if (!parseClassEscape(&n.set))
+                    {
+                        int e = parseEscape();
+                        n.set.push_back(std::make_pair(e, e));
+                    }
+                break;
+
+                case '^': case '$': case '*': case '+': case '?': case '{':
+                    ok = false;
+                    ++i;
+                break;
+
+                default:
+                    ++i;
+                    n.set.push_back(std::make_pair(c, c));
+            }
+            return n;
+        }
+
+        RangeSet parseClass()
+        {
+            RangeSet r;
+            ++i;
+            bool neg = false, first = true;
+            if (!atEnd() && peek() == '^')
+                neg = true, ++i;
+            while (ok)
+            {
+                if (atEnd())
+                {
+                    ok = false;
+                    break;
+                }
+                if (peek() == ']' && !first)
+                {
+                    ++i;
+                    break;
+                }
+                first = false;
+                if (peek() == '\\' && parseClassEscape(&r))
+                    continue;
+                int lo = peek() == '\\' ? parseEscape() : s[i++].unicode(),
+                    hi = lo;
+                if (i+1 < s.size() && peek() == '-' && s[i+1] != ']')
+                {
+                    ++i;
+                    hi = peek() == '\\' ? parseEscape() : s[i++].unicode();
+                }
+                if (hi < lo)
+                    ok = false;
+                r.push_back(std::make_pair(lo, hi));
+            }
+            normalize(r);
+            return neg ? inverted(r) : r;
+        }
+
+        /** Appends the set for \d, \s, \w or their negation */
+        bool parseClassEscape(RangeSet* r)
+        {
+            if (i+1 >= s.size())
+                return false;
+            const RangeSet* set = charClass(s[i+1].unicode());
+            if (!set)
+                return false;
+            i += 2;
+            r->insert(r->end(), set->begin(), set->end());
+            return true;
+        }
+
+        /** Single character escapes */
+        int parseEscape()
+        {
+            ++i;
+            if (atEnd())
+            {
+                ok = false;
+                return 0;
+            }
+            ushort c = s[i++].unicode();
+            switch (c)
+            {
+                case 'n': return '\n';
+                case 't': return '\t';
+                case 'r': return '\r';
+                case 'f': return '\f';
+                case 'v': return '\v';
+                case 'a': return '\a';
+                case 'x':
+                {
+                    int v = 0, n = 0;
+                    while (n < 4 && !atEnd()
+                           && peek() < 128 && isxdigit(peek()))
+                    {
+                        ushort h = s[i++].unicode();
+                        v = v * 16 + (isdigit(h) ? h - '0' : (h | 32) - 'a' + 10);
+                        ++n;
+                    }
+                    if (!n)
+                        ok = false;
+                    return v;
+                }
+            }
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                || (c >= '0' && c <= '9'))
+                ok = false;
+            return c;
+        }
+
+        int parseInt()
+        {
+            int v = 0, n = 0;
+            for (; !atEnd() && peek() >= '0' && peek() <= '9'; ++i, ++n)
+                v = v * 10 + peek() - '0';
+            if (!n)
+                ok = false;
+            return v;
+        }
+
+        const QString& s;
+        int i;
+        bool ok;
+    };
+
+
+    /** Thompson construction, each state has epsilon edges
+        and at most one character-set edge */
+    class Nfa
+    {
+    public:
+        struct State
+        {
+            std::vector<int> eps;
+            RangeSet set;
+            int to, accept;
+        };
+
+        std::vector<State> states;
+
+        int add()
+        {
+            states.push_back(State());
+            states.back().to = states.back().accept = -1;
+            return states.size() - 1;
+        }
+
+        /** Adds fragment for @p n starting at state @p s,
+            returns the (fresh) end state */
+        int build(const RegNode& n, int s)
+        {
+            switch (n.type)
+            {
+                case RegNode::N_SET:
+                {
+                    int e = add();
+                    states[s].set = n.set;
+                    states[s].to = e;
+                    return e;
+                }
+
+                case RegNode::N_CAT:
+                    for (auto& c : n.nodes)
+                        s = build(c, s);
+                    return s;
+
+                case RegNode::N_ALT:
+                {
+                    int e = add();
+                    for (auto& c : n.nodes)
+                    {
+                        int k = add();
+                        states[s].eps.push_back(k);
+                        k = build(c, k);
+                        states[k].eps.push_back(e);
+                    }
+                    return e;
+                }
+
+                case RegNode::N_REP:
+                {
+                    for (int k=0; k<n.min; ++k)
+                        s = build(n.nodes[0], s);
+                    int e = add();
+                    if (n.max < 0)
+                    {
+                        int l = add();
+                        states[s].eps.push_back(l);
+                        states[s].eps.push_back(e);
+                        int le = build(n.nodes[0], l);
+                        states[le].eps.push_back(l);
+                        states[le].eps.push_back(e);
+                        return e;
+                    }
+                    for (int k=n.min; k<n.max; ++k)
+                    {
+                        int o = add();
+                        states[s].eps.push_back(e);
+                        states[s].eps.push_back(o);
+                        s = build(n.nodes[0], o);
+                    }
+                    states[s].eps.push_back(e);
+                    return e;
+                }
+            }
+            return s;
+        }
+
+        void closure(std::vector<int>& set) const
+        {
+            std::vector<bool> seen(states.size(), false);
+            std::vector<int> work(set);
+            set.clear();
+            while (!work.empty())
+            {
+                int s = work.back();
+                work.pop_back();
+                if (seen[s])
+                    continue;
+                seen[s] = true;
+                set.push_back(s);
+                for (int e : states[s].eps)
+                    work.push_back(e);
+            }
+            std::sort(set.begin(), set.end());
+        }
+    };
+
+} // namespace
+
+
+TokenDfa::TokenDfa(const std::vector<Token>& tokens)
+{
+    Nfa nfa;
+    const int start = nfa.add();
+
+    for (size_t idx=0; idx<tokens.size(); ++idx)
+    {
+        const Token& t = tokens[idx];
+        RegNode n;
+        if (t.regExp().isEmpty())
+        {
+            if (t.fixedString().isEmpty())
+                continue;
+            for (int i=0; i<t.fixedString().size(); ++i)
+            {
+                RegNode c(RegNode::N_SET);
+                ushort u = t.fixedString()[i].unicode();
+                c.set.push_back(std::make_pair(u, u));
+                n.nodes.push_back(c);
+            }
+        }
+        else if (t.regExp().patternSyntax() != QRegExp::RegExp
+              || t.regExp().caseSensitivity() != Qt::CaseSensitive
+              || t.regExp().isMinimal()
+              || !RegParser(t.regExp().pattern()).parse(&n))
+        {
+            p_fallback.push_back(std::make_pair(int(idx), t));
+            continue;
+        }
+
+        int s = nfa.add();
+        nfa.states[start].eps.push_back(s);
+        s = nfa.build(n, s);
+        nfa.states[s].accept = idx;
+    }
+
+    // subset construction
+    std::map<std::vector<int>, int> ids;
+    std::vector<std::vector<int>> sets;
+
+    std::vector<int> set(1, start);
+    nfa.closure(set);
+    ids.insert(std::make_pair(set, 0));
+    sets.push_back(set);
+
+    for (size_t d=0; d<sets.size(); ++d)
+    {
+        State st;
+        st.accept = -1;
+        st.edgeBegin = p_edges.size();
+
+        std::vector<int> points;
+        for (int s : sets[d])
+        {
+            const Nfa::State& ns = nfa.states[s];
+            if (ns.accept >= 0 && (st.accept < 0 || ns.accept < st.accept))
+                st.accept = ns.accept;
+            for (auto& r : ns.set)
+            {
+                points.push_back(r.first);
+                points.push_back(r.second + 1);
+            }
+        }
+        std::sort(points.begin(), points.end());
+        points.erase(std::unique(points.begin(), points.end()), points.end());
+
+        for (size_t k=0; k+1<points.size(); ++k)
+        {
+            const int lo = points[k], hi = points[k+1] - 1;
+            set.clear();
+            for (int s : sets[d])
+                if (nfa.states[s].to >= 0 && contains(nfa.states[s].set, lo))
+                    set.push_back(nfa.states[s].to);
+            if (set.empty())
+                continue;
+            nfa.closure(set);
+
+            int to;
+            auto i = ids.find(set);
+            if (i != ids.end())
+                to = i->second;
+            else
+            {
+                to = sets.size();
+                ids.insert(std::make_pair(set, to));
+                sets.push_back(set);
+            }
+
+            if (int(p_edges.size()) > st.edgeBegin && p_edges.back().to == to
+                    && p_edges.back().hi + 1 == lo)
+                p_edges.back().hi = hi;
+            else
+                p_edges.push_back(Edge{ ushort(lo), ushort(hi), to });
+        }
+
+        st.edgeEnd = p_edges.size();
+        p_states.push_back(st);
+    }
+
+    p_ascii.resize(p_states.size() * 128, -1);
+    for (size_t s=0; s<p_states.size(); ++s)
+        for (int e=p_states[s].edgeBegin; e<p_states[s].edgeEnd; ++e)
+            for (int c=p_edges[e].lo; c<=p_edges[e].hi && c<128; ++c)
+                p_ascii[s*128 + c] = p_edges[e].to;
+}
+
+bool TokenDfa::firstChars(const Token& t,
+                          std::vector<std::pair<int, int>>* ranges)
+{
+    TokenDfa dfa(std::vector<Token>(1, t));
+    if (!dfa.p_fallback.empty())
+        return false;
+    const State& start = dfa.p_states[0];
+    for (int e=start.edgeBegin; e<start.edgeEnd; ++e)
+        ranges->push_back(std::make_pair(dfa.p_edges[e].lo,
+                                         dfa.p_edges[e].hi));
+    return true;
+}
+
+int TokenDfa::p_step(int state, ushort c) const
+{
+    if (c < 128)
+        return p_ascii[state*128 + c];
+
+    int lo = p_states[state].edgeBegin, hi = p_states[state].edgeEnd;
+    while (lo < hi)
+    {
+        int m = (lo + hi) / 2;
+        if (c > p_edges[m].hi)
+            lo = m + 1;
+        else if (c < p_edges[m].lo)
+            hi = m;
+        else
+            return p_edges[m].to;
+    }
+    return -1;
+}
+
+bool TokenDfa::isValidFor(int numTokens) const
+{
+    for (const State& st : p_states)
+        if (st.accept >= numTokens)
+            return false;
+    for (const auto& f : p_fallback)
+        if (f.first < 0 || f.first >= numTokens)
+            return false;
+    return true;
+}
+
+int TokenDfa::match(const QString& s, int pos, int* len) const
+{
+    int best = -1, bestLen = 0, state = 0;
+    const QChar* c = s.constData();
+    for (int p=pos; p<s.size(); ++p)
+    {
+        state = p_step(state, c[p].unicode());
+        if (state < 0)
+            break;
+        if (p_states[state].accept >= 0)
+            best = p_states[state].accept, bestLen = p + 1 - pos;
+    }
+
+    for (auto& f : p_fallback)
+    {
+        int p = pos;
+        if (!f.second.isMatch(s, &p))
+            continue;
+        if (p - pos > bestLen || (p - pos == bestLen && f.first < best))
+            best = f.first, bestLen = p - pos;
+    }
+
+    *len = bestLen;
+    return best;
+}
+
+int TokenDfa::match(const Utf8Input& s, int pos, int* len) const
+{
+    int best = -1, bestLen = 0, state = 0;
+    for (int p=pos; p<s.size(); )
+    {
+        const uchar b = s.data()[p];
+        if (b < 0x80)
+        {
+            state = p_ascii[state*128 + b];
+            ++p;
+        }
+        else
+        {
+            // same alphabet as QString, utf-16 units
+            const uint c = s.decode(&p);
+            if (c < 0x10000)
+                state = p_step(state, c);
+            else
+            {
+                state = p_step(state, QChar::highSurrogate(c));
+                if (state >= 0)
+                    state = p_step(state, QChar::lowSurrogate(c));
+            }
+        }
+        if (state < 0)
+            break;
+        if (p_states[state].accept >= 0)
+            best = p_states[state].accept, bestLen = p - pos;
+    }
+
+    if (!p_fallback.empty())
+    {
+        int end = std::min(s.size(), pos + fallbackWindow());
+        while (end < s.size() && (s.data()[end] & 0xc0) == 0x80)
+            --end;
+        const QString window = s.text(pos, end - pos);
+        for (auto& f : p_fallback)
+        {
+            int p = 0;
+            if (!f.second.isMatch(window, &p) || p == 0)
+                continue;
+            const int bytes = window.left(p).toUtf8().size();
+            if (bytes > bestLen || (bytes == bestLen && f.first < best))
+                best = f.first, bestLen = bytes;
+        }
+    }
+
+    *len = bestLen;
+    return best;
+}
+
+
+QDataStream& operator << (QDataStream& s, const TokenDfa& d)
+{
+    s << quint32(d.p_states.size());
+    for (const TokenDfa::State& st : d.p_states)
+        s << qint32(st.edgeBegin) << qint32(st.edgeEnd) << qint32(st.accept);
+    s << quint32(d.p_edges.size());
+    for (const TokenDfa::Edge& e : d.p_edges)
+        s << quint16(e.lo) << quint16(e.hi) << qint32(e.to);
+    GrammarData::write(s, d.p_ascii);
+    s << quint32(d.p_fallback.size());
+    for (const auto& f : d.p_fallback)
+        s << qint32(f.first) << f.second;
+    return s;
+}
+
+QDataStream& operator >> (QDataStream& s, TokenDfa& d)
+{
+    quint32 n;
+    if (!GrammarData::readSize(s, &n))
+        return s;
+    d.p_states.resize(n);
+    for (TokenDfa::State& st : d.p_states)
+    {
+        qint32 b, e, a;
+        s >> b >> e >> a;
+        st.edgeBegin = b;
+        st.edgeEnd = e;
+        st.accept = a;
+    }
+    if (!GrammarData::readSize(s, &n))
+        return s;
+    d.p_edges.resize(n);
+    for (TokenDfa::Edge& e : d.p_edges)
+    {
+        quint16 lo, hi;
+        qint32 to;
+        s >> lo >> hi >> to;
+        e.lo = lo;
+        e.hi = hi;
+        e.to = to;
+    }
+    if (!GrammarData::read(s, d.p_ascii) || !GrammarData::readSize(s, &n))
+        return s;
+    d.p_fallback.resize(n);
+    for (auto& f : d.p_fallback)
+    {
+        qint32 idx;
+        s >> idx >> f.second;
+        f.first = idx;
+    }
+
+    // the matcher trusts the tables
+    for (const TokenDfa::State& st : d.p_states)
+        if (st.edgeBegin < 0 || st.edgeBegin > st.edgeEnd
+                || st.edgeEnd > int(d.p_edges.size()))
+            s.setStatus(QDataStream::ReadCorruptData);
+    for (const TokenDfa::Edge& e : d.p_edges)
+        if (e.to < -1 || e.to >= int(d.p_states.size()))
+            s.setStatus(QDataStream::ReadCorruptData);
+    for (int to : d.p_ascii)
+        if (to < -1 || to >= int(d.p_states.size()))
+            s.setStatus(QDataStream::ReadCorruptData);
+    if (d.p_states.empty() || d.p_ascii.size() != d.p_states.size() * 128)
+        s.setStatus(QDataStream::ReadCorruptData);
+    return s;
+}
@@ -0,0 +1,107 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef TOKENDFA_H
+#define TOKENDFA_H
+
+#include <vector>
+
+#include <QString>
+
+#include "Tokens.h"
+#include "Utf8Input.h"
+
+/** A single deterministic automaton built from all Tokens of a lexxer.
+
+    Fixed strings and the regular subset of QRegExp patterns
+    (literals, escapes, \\d \\s \\w, '.', [classes], (groups), '|',
+    '*', '+', '?', {n,m}) are merged into one DFA that is run once per
+    input position. Tokens whose pattern uses anything else (anchors,
+    lookahead, minimal matching, case-insensitivity, ...) are kept as
+    fallback and probed individually with Token::isMatch().
+
+    The result is identical to probing every Token:
+    longest match wins, on equal length the first declared Token wins. */
+class TokenDfa
+{
+public:
+    explicit TokenDfa(const std::vector<Token>& tokens);
+    /** Matches nothing, for reading with operator >> */
+    TokenDfa() { }
+
+    /** Returns the index of the best matching token at @p pos or -1.
+        Writes the length of the match to @p len. Zero-length matches
+        are never reported. */
+    int match(const QString& s, int pos, int* len) const;
+
+    /** Same as match() for UTF-8 input, @p len is in bytes.
+        Fallback tokens only see the next fallbackWindow() bytes. */
+    int match(const Utf8Input& s, int pos, int* len) const;
+
+    static int fallbackWindow() { return 1024; }
+
+    /** Collects the ranges of characters a match of @p t can start with.
+        Returns false if that is unknown, i.e. the Token would be
+        a fallback token. */
+    static bool firstChars(const Token& t,
+                           std::vector<std::pair<int, int>>* ranges);
+
+    /** Reports only token indices below @p numTokens,
+        false for corrupt data read with operator >> */
+    bool isValidFor(int numTokens) const;
+
+    int numStates() const { return p_states.size(); }
+    int numFallbackTokens() const { return p_fallback.size(); }
+
+private:
+    struct Edge
+    {
+        ushort lo, hi;
+        int to;
+    };
+    struct State
+    {
+        int edgeBegin, edgeEnd;
+        int accept;
+    };
+
+    int p_step(int state, ushort c) const;
+
+    friend QDataStream& operator << (QDataStream&, const TokenDfa&);
+    friend QDataStream& operator >> (QDataStream&, TokenDfa&);
+
+    std::vector<State> p_states;
+    std::vector<Edge> p_edges;
+    /** transition table for ascii characters, 128 entries per state */
+    std::vector<int> p_ascii;
+    /** tokens that are not part of the automaton, with their index */
+    std::vector<std::pair<int, Token>> p_fallback;
+};
+
+QDataStream& operator << (QDataStream& s, const TokenDfa& d);
+QDataStream& operator >> (QDataStream& s, TokenDfa& d);
+
+#endif // TOKENDFA_H
@@ -0,0 +1,140 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <memory>
+#include <climits>
+
+#include <QIODevice>
+#include <QTextStream>
+
+#include "TokenStream.h"
+
+TokenStream::TokenStream(const Tokens& lexxer, QIODevice* device,
+                         int lookahead)
+    : TokenStream(lexxer, ChunkFunc(), lookahead)
+{
+    std::shared_ptr<QTextStream> stream(new QTextStream(device));
+    stream->setCodec("UTF-8");
+    p_chunk = [=]() { return stream->read(lookahead); };
+}
+
+TokenStream::TokenStream(const Tokens& lexxer, ChunkFunc nextChunk,
+                         int lookahead)
+    : p_lexxer      (lexxer)
+    , p_chunk       (nextChunk)
+    , p_lookahead   (std::max(1, lookahead))
+    , p_bufStart    (0)
+    , p_pos         (0)
+    , p_line        (0)
+    , p_limit       (INT_MAX)
+    , p_atEnd       (false)
+    , p_done        (false)
+    , p_truncated   (false)
+    , p_first       (0)
+    , p_maxTokens   (0)
+    , p_maxText     (0)
+{
+
+}
+
+void TokenStream::p_lexNext()
+{
+    while (true)
+    {
+        if (!p_atEnd && p_buf.size() - p_pos < 2 * p_lookahead)
+        {
+            p_refill();
+            continue;
+        }
+
+        int pos = p_pos, line = p_line;
+        LexxedToken t = p_lexxer.next(p_buf, &pos, &line, p_bufStart);
+
+        const int safe = p_buf.size() - p_lookahead;
+        if (!p_atEnd && (t.pos().pos() - p_bufStart > safe
+                         || pos >= p_buf.size()))
+        {
+            // everything up to the token was skipped,
+            // keep that progress and lex again with more text
+            for (; p_pos < safe && p_pos < t.pos().pos() - p_bufStart;
+                 ++p_pos)
+                if (p_buf[p_pos] == '\n')
+                    ++p_line;
+            p_refill();
+            continue;
+        }
+
+        p_pos = pos;
+        p_line = line;
+        p_tokens.push_back(t);
+        p_done = t.kind() == Tokens::K_EOF;
+        p_maxTokens = std::max(p_maxTokens, p_tokens.size());
+        return;
+    }
+}
+
+void TokenStream::p_refill()
+{
+    // drop text before the first buffered token
+    int keep = p_tokens.empty()
+            ? p_pos
+            : std::min(p_pos, p_tokens.front().pos().pos() - p_bufStart);
+    if (keep > 0)
+    {
+        p_buf.remove(0, keep);
+        p_bufStart += keep;
+        p_pos -= keep;
+    }
+
+    QString chunk = p_chunk();
+    if (chunk.isEmpty())
+    {
+        p_atEnd = true;
+        chunk = p_pending;
+        p_pending.clear();
+    }
+    else
+    {
+        chunk.prepend(p_pending);
+        p_pending.clear();
+        // don't split surrogate pairs between chunks
+        if (chunk.at(chunk.size()-1).isHighSurrogate())
+        {
+            p_pending = chunk.right(1);
+            chunk.chop(1);
+        }
+    }
+    // positions must fit into int
+    const int room = p_limit - p_bufStart - p_buf.size();
+    if (chunk.size() > room)
+    {
+        chunk.truncate(room);
+        p_atEnd = p_truncated = true;
+        p_pending.clear();
+    }
+    p_buf += Tokens::validUtf16(chunk);
+    p_maxText = std::max(p_maxText, p_buf.size());
+}
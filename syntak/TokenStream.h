@@ -0,0 +1,122 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef TOKENSTREAM_H
+#define TOKENSTREAM_H
+
+#include <deque>
+#include <functional>
+
+#include <QString>
+
+#include "Tokens.h"
+
+class QIODevice;
+
+/** Pull-lexxer that reads the input in chunks.
+
+    Tokens are lexxed on demand into a window that the consumer
+    shrinks with release(). Text and tokens before the released
+    index are dropped, so memory stays bounded by the window plus
+    the lookahead, not by the input size.
+
+    A token must start at least @p lookahead characters before the end
+    of the buffered text to be lexxed, so regexps that need to see
+    more than that to decide (e.g. a very long quoted string)
+    are not recognized reliably.
+
+    Positions are int, like in QString, so at most textLimit()
+    characters are read, about 2 GiB of ASCII text. Longer input
+    ends at the limit with isTruncated() set. */
+class TokenStream
+{
+public:
+    /** Returns the next chunk of text, or an empty string at the end */
+    typedef std::function<QString()> ChunkFunc;
+
+    /** Reads UTF-8 text from @p device, which must stay open */
+    TokenStream(const Tokens& lexxer, QIODevice* device,
+                int lookahead = 1 << 14);
+    TokenStream(const Tokens& lexxer, ChunkFunc nextChunk,
+                int lookahead = 1 << 14);
+
+    /** Returns true if there is a token at absolute index @p idx,
+        lexxing on demand. The last token is of kind Tokens::K_EOF. */
+    bool has(size_t idx)
+    {
+        while (idx >= p_first + p_tokens.size() && !p_done)
+            p_lexNext();
+        return idx < p_first + p_tokens.size();
+    }
+
+    /** Token at absolute index, has() must have returned true
+        and @p idx must not be released */
+    const LexxedToken& at(size_t idx) const
+        { return p_tokens[idx - p_first]; }
+
+    /** Drops the tokens before index @p idx and the text before them */
+    void release(size_t idx)
+    {
+        while (p_first < idx && !p_tokens.empty())
+            p_tokens.pop_front(), ++p_first;
+    }
+
+    /** Character at absolute text position, must not be released */
+    QChar charAt(int pos) const { return p_buf[pos - p_bufStart]; }
+    /** Text at absolute position, must not be released */
+    QString mid(int pos, int len) const
+        { return p_buf.mid(pos - p_bufStart, len); }
+    /** Absolute position behind the text read so far */
+    int textEnd() const { return p_bufStart + p_buf.size(); }
+
+    /** Number of characters read at most, INT_MAX by default */
+    int textLimit() const { return p_limit; }
+    /** Sets textLimit(), before the first token is requested */
+    void setTextLimit(int chars) { p_limit = std::max(0, chars); }
+    /** The input was longer than textLimit(), the K_EOF token
+        stands at the limit */
+    bool isTruncated() const { return p_truncated; }
+
+    size_t maxBufferedTokens() const { return p_maxTokens; }
+    int maxBufferedText() const { return p_maxText; }
+
+private:
+    void p_lexNext();
+    void p_refill();
+
+    Tokens p_lexxer;
+    ChunkFunc p_chunk;
+    const int p_lookahead;
+    QString p_buf, p_pending;
+    int p_bufStart, p_pos, p_line;
+    int p_limit;
+    bool p_atEnd, p_done, p_truncated;
+    std::deque<LexxedToken> p_tokens;
+    size_t p_first, p_maxTokens;
+    int p_maxText;
+};
+
+#endif // TOKENSTREAM_H
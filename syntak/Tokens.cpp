@@ -24,9 +24,15 @@ SOFTWARE.
 
 ****************************************************************************/
 
+#include <thread>
+
 #include <QDebug>
+#include <QThread>
 
 #include "Tokens.h"
+#include "TokenDfa.h"
+#include "Utf8Input.h"
+#include "GrammarData.h"
 
 QString SourcePos::toString() const
 {
@@ -38,15 +44,22 @@ bool Token::isMatch(const QString& s, int* pos) const
 {
     if (p_regexp.isEmpty())
     {
-        int ps = *pos, pt = 0;
-        while (ps < s.size() && pt < p_fixed.length())
-        {
-            if (s[ps] != p_fixed[pt])
-                return false;
-            ++pt;
-            ++ps;
-        }
-        *pos = ps;
+        if (s.size() - *pos < p_fixed.length()
+            || !Scanner::equal(s.constData() + *pos, p_fixed.constData(),
+                               p_fixed.length()))
+            return false;
+        *pos += p_fixed.length();
+        return true;
+    }
+    else if (p_pcre)
+    {
+        auto m = p_anchored.match(
+                    s, *pos, QRegularExpression::NormalMatch,
+                    QRegularExpression::AnchoredMatchOption
+                    | QRegularExpression::DontCheckSubjectStringMatchOption);
+        if (!m.hasMatch())
+            return false;
+        *pos += m.capturedLength();
         return true;
     }
     else
@@ -60,3 +73,532 @@ bool Token::isMatch(const QString& s, int* pos) const
     }
 }
 
+namespace {
+
+    /** Replaces the unescaped '$' outside of character classes by \z.
+        In QRegExp it only matches at the end of the string, in pcre
+        also before a final newline. */
+    QString dollarEndOnly(const QString& pattern)
+    {
+        QString s;
+        bool inClass = false;
+        for (int i=0; i<pattern.size(); ++i)
+        {
+            const QChar c = pattern[i];
+            if (c == '\\' && i+1 < pattern.size())
+            {
+                s += c;
+                s += pattern[++i];
+                continue;
+            }
+            if (c == '[' && !inClass)
+            {
+                // a leading ']' is part of the class
+                inClass = true;
+                s += c;
+                if (i+1 < pattern.size() && pattern[i+1] == '^')
+                    s += pattern[++i];
+                if (i+1 < pattern.size() && pattern[i+1] == ']')
+                    s += pattern[++i];
+                continue;
+            }
+            if (c == ']')
+                inClass = false;
+            if (c == '$' && !inClass)
+                s += "\\z";
+            else
+                s += c;
+        }
+        return s;
+    }
+
+} // namespace
+
+void Token::p_compile()
+{
+    QString pattern;
+    switch (p_regexp.patternSyntax())
+    {
+        case QRegExp::RegExp:
+        case QRegExp::RegExp2:
+            pattern = dollarEndOnly(p_regexp.pattern());
+        break;
+        case QRegExp::FixedString:
+            pattern = QRegularExpression::escape(p_regexp.pattern());
+        break;
+        default:
+            // wildcards are only understood by QRegExp
+            return;
+    }
+
+    // \d, \w etc. are unicode aware and '.' matches newlines in QRegExp
+    QRegularExpression::PatternOptions opts =
+            QRegularExpression::UseUnicodePropertiesOption
+            | QRegularExpression::DotMatchesEverythingOption;
+    if (p_regexp.caseSensitivity() == Qt::CaseInsensitive)
+        opts |= QRegularExpression::CaseInsensitiveOption;
+    if (p_regexp.isMinimal())
+        opts |= QRegularExpression::InvertedGreedinessOption;
+
+    p_anchored = QRegularExpression(pattern, opts);
+    p_pcre = p_anchored.isValid();
+    if (p_pcre)
+        p_anchored.optimize();
+    else
+        qWarning() << "Token" << p_name << "regexp" << pattern
+                   << "not valid:" << p_anchored.errorString();
+}
+
+
+QDataStream& operator << (QDataStream& s, const Token& t)
+{
+    s << t.name() << t.fixedString() << t.regExp().pattern()
+      << qint32(t.regExp().patternSyntax())
+      << qint32(t.regExp().caseSensitivity())
+      << t.regExp().isMinimal();
+    return s;
+}
+
+QDataStream& operator >> (QDataStream& s, Token& t)
+{
+    QString name, fixed, pattern;
+    qint32 syntax, cs;
+    bool minimal;
+    s >> name >> fixed >> pattern >> syntax >> cs >> minimal;
+    if (s.status() != QDataStream::Ok)
+        return s;
+    if (pattern.isEmpty())
+        t = Token(name, fixed);
+    else
+    {
+        QRegExp r(pattern, Qt::CaseSensitivity(cs),
+                  QRegExp::PatternSyntax(syntax));
+        r.setMinimal(minimal);
+        t = Token(name, r);
+    }
+    return s;
+}
+
+QDataStream& operator << (QDataStream& s, const Tokens& t)
+{
+    s << qint32(t.p_mode) << qint32(t.p_numThreads);
+    GrammarData::write(s, t.p_tokens);
+    GrammarData::write(s, t.p_first);
+    GrammarData::write(s, t.p_firstOther);
+    s << bool(t.p_dfa);
+    if (t.p_dfa)
+        s << *t.p_dfa;
+    return s;
+}
+
+QDataStream& operator >> (QDataStream& s, Tokens& t)
+{
+    qint32 mode, threads;
+    bool hasDfa = false;
+    s >> mode >> threads;
+    t.p_mode = Tokens::Mode(mode);
+    t.p_numThreads = threads;
+    t.p_dfa.reset();
+    if (GrammarData::read(s, t.p_tokens)
+            && GrammarData::read(s, t.p_first)
+            && GrammarData::read(s, t.p_firstOther)
+            && GrammarData::read(s, hasDfa) && hasDfa)
+    {
+        auto dfa = std::make_shared<TokenDfa>();
+        s >> *dfa;
+        t.p_dfa = dfa;
+        if (!dfa->isValidFor(t.p_tokens.size()))
+            s.setStatus(QDataStream::ReadCorruptData);
+    }
+    // the first char index refers to tokens as well
+    for (const auto& v : t.p_first)
+        for (int idx : v)
+            if (idx < 0 || idx >= int(t.p_tokens.size()))
+                s.setStatus(QDataStream::ReadCorruptData);
+    for (int idx : t.p_firstOther)
+        if (idx < 0 || idx >= int(t.p_tokens.size()))
+            s.setStatus(QDataStream::ReadCorruptData);
+    if (!t.p_first.empty() && t.p_first.size() != 128)
+        s.setStatus(QDataStream::ReadCorruptData);
+    return s;
+}
+
+const QString& Tokens::name(int kind) const
+{
+    static const QString eof("EOF"), invalid;
+    if (kind == K_EOF)
+        return eof;
+    if (kind < 1 || kind > int(p_tokens.size()))
+        return invalid;
+    return p_tokens[kind - 1].name();
+}
+
+QString Tokens::validUtf16(const QString& input)
+{
+    const QChar* c = input.constData();
+    QString copy;
+    for (int i=0; i<input.size(); ++i)
+    {
+        if (!c[i].isSurrogate())
+            continue;
+        if (c[i].isHighSurrogate() && i+1 < input.size()
+                && c[i+1].isLowSurrogate())
+        {
+            ++i;
+            continue;
+        }
+        if (copy.isEmpty())
+            copy = input;
+        copy[i] = QChar::ReplacementCharacter;
+    }
+    return copy.isEmpty() ? input : copy;
+}
+
+bool Tokens::isValidUtf16(const QString& input)
+{
+    const QChar* c = input.constData();
+    for (int i=0; i<input.size(); ++i)
+    {
+        if (!c[i].isSurrogate())
+            continue;
+        if (!c[i].isHighSurrogate() || i+1 >= input.size()
+                || !c[i+1].isLowSurrogate())
+            return false;
+        ++i;
+    }
+    return true;
+}
+
+LexxedToken Tokens::next(const QString& input, int* pos, int* line,
+                         int offset) const
+{
+    int i = *pos;
+    while (i<input.size())
+    {
+        i = Scanner::skipSpace(input.constData(), i, input.size(), line);
+        if (i >= input.size())
+            break;
+
+        // non-ascii whitespace
+        if (input[i].isSpace())
+        {
+            ++i;
+            continue;
+        }
+
+        int len;
+        const Token* best = match(input, i, &len);
+        if (!best)
+        {
+            ++i;
+            continue;
+        }
+
+        LexxedToken t(best - &p_tokens[0] + 1, i + offset, len, *line);
+        for (int end = i + len; i < end; ++i)
+            if (input[i] == '\n')
+                ++*line;
+        *pos = i;
+        return t;
+    }
+
+    *pos = i;
+    return LexxedToken(K_EOF, i + offset, 0, *line);
+}
+
+LexxedToken Tokens::next(const Utf8Input& input, int* pos, int* line) const
+{
+    const TokenDfa& dfa = p_compiled();
+    int i = *pos;
+    while (i<input.size())
+    {
+        if (input.isAsciiSpace(i))
+        {
+            if (input.data()[i] == '\n')
+                ++*line;
+            ++i;
+            continue;
+        }
+
+        // non-ascii whitespace
+        if (uchar(input.data()[i]) >= 0x80)
+        {
+            int p = i;
+            if (QChar::isSpace(input.decode(&p)))
+            {
+                i = p;
+                continue;
+            }
+        }
+
+        int len;
+        const int idx = dfa.match(input, i, &len);
+        if (idx < 0)
+        {
+            input.decode(&i);
+            continue;
+        }
+
+        LexxedToken t(idx + 1, i, len, *line);
+        for (int end = i + len; i < end; ++i)
+            if (input.data()[i] == '\n')
+                ++*line;
+        *pos = i;
+        return t;
+    }
+
+    *pos = i;
+    return LexxedToken(K_EOF, i, 0, *line);
+}
+
+namespace {
+
+    /** Tokens lexxed from one chunk, starting at the chunk begin
+        with line 0, up to the first token starting at or after end */
+    struct LexChunk
+    {
+        int begin, end, endPos, endLine;
+        std::vector<LexxedToken> tokens;
+    };
+
+} // namespace
+
+bool Tokens::p_tokenizeParallel(const QString& input,
+                                std::vector<LexxedToken>& output,
+                                int numThreads) const
+{
+    if (!isThreadSafe())
+        return false;
+
+    int threads = numThreads > 0 ? numThreads
+                                 : QThread::idealThreadCount();
+    threads = std::min(threads, input.size() / P_MIN_CHUNK);
+    if (threads < 2)
+        return false;
+
+    // build lazy tables before sharing
+    prepare();
+
+    // split behind newlines, tokens spanning a split are repaired below
+    std::vector<LexChunk> chunks;
+    int begin = 0;
+    for (int i=1; i<=threads && begin < input.size(); ++i)
+    {
+        int end = i == threads ? input.size()
+                               : int(qint64(input.size()) * i / threads);
+        end = std::max(end, begin + 1);
+        while (end < input.size() && input[end-1] != '\n')
+            ++end;
+        LexChunk c;
+        c.begin = c.endPos = begin;
+        c.end = end;
+        c.endLine = 0;
+        chunks.push_back(c);
+        begin = end;
+    }
+
+    auto lexChunk = [this, &input](LexChunk& c)
+    {
+        int pos = c.begin, line = 0;
+        for (;;)
+        {
+            int p = pos, l = line;
+            LexxedToken t = next(input, &p, &l);
+            if (t.kind() == K_EOF || t.pos().pos() >= c.end)
+                break;
+            c.tokens.push_back(t);
+            pos = p;
+            line = l;
+        }
+        c.endPos = pos;
+        c.endLine = line;
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i=1; i<chunks.size(); ++i)
+        workers.push_back(std::thread(lexChunk, std::ref(chunks[i])));
+    lexChunk(chunks[0]);
+    for (auto& w : workers)
+        w.join();
+
+    // Stitch in order. Lexxing only depends on the position, so once
+    // a sequentially lexxed token starts at the same position as a
+    // token of the chunk, the rest of the chunk is correct, apart
+    // from the line numbers.
+    int pos = 0, line = 0;
+    for (const LexChunk& c : chunks)
+    {
+        size_t j = 0;
+        for (;;)
+        {
+            int p = pos, l = line;
+            LexxedToken t = next(input, &p, &l);
+            if (t.kind() == K_EOF || t.pos().pos() >= c.end)
+                break;
+
+            while (j < c.tokens.size()
+                   && c.tokens[j].pos().pos() < t.pos().pos())
+                ++j;
+            if (j < c.tokens.size() && c.tokens[j].pos().pos() == t.pos().pos())
+            {
+                const int lines = t.pos().line() - c.tokens[j].pos().line();
+                for (; j < c.tokens.size(); ++j)
+                {
+                    const LexxedToken& ct = c.tokens[j];
+                    output.push_back(LexxedToken(
+                            ct.kind(), ct.pos().pos(), ct.length(),
+                            ct.pos().line() + lines));
+                }
+                pos = c.endPos;
+                line = c.endLine + lines;
+                break;
+            }
+
+            // token across the chunk start, lex on until in sync
+            output.push_back(t);
+            pos = p;
+            line = l;
+        }
+    }
+    output.push_back(next(input, &pos, &line));
+    return true;
+}
+
+int Tokens::relex(const QString& text, std::vector<LexxedToken>& tokens,
+                  const TextEdit& edit, int* first) const
+{
+    if (first)
+        *first = 0;
+    if (tokens.empty())
+    {
+        tokenize(text, tokens);
+        return tokens.size();
+    }
+
+    // first token reaching into the line of the edit,
+    // one more back for tokens looking ahead
+    int lineStart = std::min(edit.offset(), text.size());
+    while (lineStart > 0 && text[lineStart-1] != '\n')
+        --lineStart;
+    auto endsBefore = [](const LexxedToken& t, int start)
+        { return t.pos().pos() + t.length() < start; };
+    const size_t k = std::lower_bound(tokens.begin(), tokens.end(),
+                                      lineStart, endsBefore) - tokens.begin();
+    const size_t r = k > 0 ? k - 1 : 0;
+
+    int pos = r > 0 ? tokens[r].pos().pos() : 0,
+        line = r > 0 ? tokens[r].pos().line() : 0;
+    const int editEnd = edit.offset() + edit.inserted(),
+              oldEditEnd = edit.offset() + edit.removed();
+
+    std::vector<LexxedToken> fresh;
+    size_t j = k;
+    int lines = 0;
+    for (;;)
+    {
+        LexxedToken t = next(text, &pos, &line);
+        if (t.pos().pos() >= editEnd)
+        {
+            // same token at the same place in the unchanged text
+            const int oldPos = t.pos().pos() - edit.delta();
+            while (j < tokens.size() && tokens[j].pos().pos() < oldPos)
+                ++j;
+            if (j < tokens.size() && tokens[j].pos().pos() == oldPos
+                    && oldPos >= oldEditEnd)
+            {
+                lines = t.pos().line() - tokens[j].pos().line();
+                break;
+            }
+        }
+        fresh.push_back(t);
+        if (t.kind() == K_EOF)
+        {
+            j = tokens.size();
+            break;
+        }
+    }
+
+    for (size_t i = j; i < tokens.size(); ++i)
+    {
+        const LexxedToken& t = tokens[i];
+        tokens[i] = LexxedToken(t.kind(), t.pos().pos() + edit.delta(),
+                                t.length(), t.pos().line() + lines);
+    }
+    tokens.erase(tokens.begin() + r, tokens.begin() + j);
+    tokens.insert(tokens.begin() + r, fresh.begin(), fresh.end());
+    if (first)
+        *first = r;
+    return fresh.size();
+}
+
+void Tokens::prepare(bool utf8) const
+{
+    if (p_mode == M_COMPILED || utf8)
+        p_compiled();
+    if (p_mode != M_COMPILED && p_first.empty())
+        p_buildFirstIndex();
+}
+
+bool Tokens::isThreadSafe() const
+{
+    for (const Token& t : p_tokens)
+        if (!t.isThreadSafe())
+            return false;
+    return true;
+}
+
+const TokenDfa& Tokens::p_compiled() const
+{
+    if (!p_dfa)
+        p_dfa = std::make_shared<TokenDfa>(p_tokens);
+    return *p_dfa;
+}
+
+const Token* Tokens::match(const QString& input, int pos, int* len) const
+{
+    if (p_mode == M_COMPILED)
+    {
+        int idx = p_compiled().match(input, pos, len);
+        return idx >= 0 ? &p_tokens[idx] : nullptr;
+    }
+
+    int mp = pos;
+    const Token* best = nullptr;
+    for (int idx : p_candidates(input[pos]))
+    {
+        const Token& t = p_tokens[idx];
+        int p = pos;
+        if (t.isMatch(input, &p) && p > mp)
+            mp = p, best = &t;
+    }
+    *len = mp - pos;
+    return best;
+}
+
+int Tokens::numCandidates(QChar c) const
+{
+    return p_candidates(c).size();
+}
+
+void Tokens::p_buildFirstIndex() const
+{
+    p_first.assign(128, std::vector<int>());
+    p_firstOther.clear();
+
+    for (size_t idx=0; idx<p_tokens.size(); ++idx)
+    {
+        std::vector<std::pair<int, int>> ranges;
+        if (!TokenDfa::firstChars(p_tokens[idx], &ranges))
+            ranges.push_back(std::make_pair(0, 0xffff));
+
+        bool other = false;
+        for (auto& r : ranges)
+        {
+            for (int c=r.first; c<=r.second && c<128; ++c)
+                p_first[c].push_back(idx);
+            other |= r.second >= 128;
+        }
+        if (other)
+            p_firstOther.push_back(idx);
+    }
+}
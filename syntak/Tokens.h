@@ -29,9 +29,19 @@ SOFTWARE.
 
 #include <map>
 #include <set>
+#include <memory>
+#include <vector>
+#include <iterator>
+#include <algorithm>
 
 #include <QString>
+#include <QStringRef>
 #include <QRegExp>
+#include <QRegularExpression>
+
+#include "Scanner.h"
+
+class QDataStream;
 
 class SourcePos
 {
@@ -49,63 +59,127 @@ private:
 class Token
 {
 public:
-    Token() { }
+    Token() : p_pcre(false) { }
     Token(const QString& name, const QString& fixedString)
         : p_name    (name)
         , p_fixed   (fixedString)
+        , p_pcre    (false)
     { }
     Token(const QString& name, const QRegExp& regexp)
         : p_name    (name)
         , p_regexp  (regexp)
-    { }
+        , p_pcre    (false)
+    { p_compile(); }
 
     const QString& name() const { return p_name; }
     const QString& fixedString() const { return p_fixed; }
+    const QRegExp& regExp() const { return p_regexp; }
 
     /** find match for token,
-        change @p pos to next index after recognized token */
+        change @p pos to next index after recognized token.
+        Regexps only match starting exactly at @p pos, so the cost
+        of a probe does not depend on the remaining input size.
+        @p s must be valid UTF-16, see Tokens::validUtf16() */
     bool isMatch(const QString& s, int* pos) const;
 
     QString tokenString() const
         { return p_regexp.isEmpty() ? p_fixed : p_regexp.pattern(); }
+
+    /** isMatch() may be called from several threads at once,
+        false for QRegExp wildcard patterns */
+    bool isThreadSafe() const { return p_regexp.isEmpty() || p_pcre; }
+    /** isMatch() only tries the position itself, false for QRegExp
+        wildcard patterns, which search the rest of the input */
+    bool isAnchored() const { return p_regexp.isEmpty() || p_pcre; }
 private:
+    void p_compile();
     QString p_name, p_fixed;
     QRegExp p_regexp;
+    /** QRegExp translated to pcre, unused for wildcard syntax */
+    QRegularExpression p_anchored;
+    bool p_pcre;
 };
 
+/** Writes the name, fixed string or regexp and its options */
+QDataStream& operator << (QDataStream& s, const Token& t);
+QDataStream& operator >> (QDataStream& s, Token& t);
+
 
 
+/** A recognized token, as offset and length into the lexxed text.
+
+    The value is not copied, use value() with the text that was
+    passed to Tokens::tokenize(). The kind is the index into
+    Tokens::tokens() plus one, or Tokens::K_EOF. */
 class LexxedToken
 {
 public:
-    LexxedToken() { }
-    LexxedToken(const QString& name, const QString& value,
-                SourcePos pos)
-        : p_name    (name)
-        , p_value   (value)
+    LexxedToken() : p_kind(-1), p_pos(0), p_len(0), p_line(0) { }
+    LexxedToken(qint32 kind, qint32 pos, qint32 length, qint32 line)
+        : p_kind    (kind)
         , p_pos     (pos)
+        , p_len     (length)
+        , p_line    (line)
     { }
 
-    bool isValid() const { return !p_name.isEmpty(); }
-    const QString& name() const { return p_name; }
-    const QString& value() const { return p_value; }
-    const SourcePos& pos() const { return p_pos; }
+    bool isValid() const { return p_kind >= 0; }
+    qint32 kind() const { return p_kind; }
+    qint32 length() const { return p_len; }
+    SourcePos pos() const { return SourcePos(p_pos, p_line); }
+
+    QStringRef value(const QString& text) const
+        { return QStringRef(&text, p_pos, p_len); }
 
 private:
-    QString p_name, p_value;
-    SourcePos p_pos;
+    qint32 p_kind, p_pos, p_len, p_line;
 };
 
 
 
+/** A change to a text: removed() chars at offset() were
+    replaced by inserted() chars */
+class TextEdit
+{
+public:
+    TextEdit(int offset = 0, int removed = 0, int inserted = 0)
+        : p_offset(offset), p_removed(removed), p_inserted(inserted) { }
+    int offset() const { return p_offset; }
+    int removed() const { return p_removed; }
+    int inserted() const { return p_inserted; }
+    /** Change of the text length */
+    int delta() const { return p_inserted - p_removed; }
+private:
+    int p_offset, p_removed, p_inserted;
+};
+
+
+
+class TokenDfa;
+class Utf8Input;
+
 class Tokens
 {
 public:
 
+    enum Mode
+    {
+        /** Probe every Token at every position */
+        M_PROBE,
+        /** Run one automaton compiled from all Tokens, see TokenDfa */
+        M_COMPILED
+    };
+
+    /** Kind of the LexxedToken appended after the last token */
+    enum { K_EOF = 0 };
+
+    Tokens() : p_mode(M_PROBE), p_numThreads(1) { }
+
     Tokens& add(const Token& t)
     {
         //p_tokens.insert(std::make_pair(t.name(), t));
         p_tokens.push_back(t);
+        p_dfa.reset();
+        p_first.clear();
         return *this;
     }
 
@@ -113,63 +187,172 @@ public:
         { return add(t); }
 
 
+    /** Lexxes @p input and appends the tokens and a final K_EOF
+        token to @p output. Large inputs are split into chunks
+        lexxed in parallel if numThreads() is not 1. */
+    template <class Container>
+    void tokenize(const QString& input, Container& output) const
+        { tokenize(input, output, p_numThreads); }
+    /** Lexxes with @p numThreads instead of numThreads() */
     template <class Container>
-    void tokenize(const QString& input, Container& output);
+    void tokenize(const QString& input, Container& output,
+                  int numThreads) const;
+
+    /** Updates @p tokens, the result of tokenize() on a text before
+        @p edit, to @p text after the edit.
+        Lexxing restarts at the last token boundary before the line
+        of the edit and stops as soon as the new tokens line up with
+        the old ones, the positions of all following tokens are shifted.
+        Returns the number of new tokens and writes the index of the
+        first one to @p first, if not NULL.
+        Matching a token, or failing to, must not look past the end
+        of the line, unless the token spans lines. E.g. an unterminated
+        multi-line comment on an earlier line that is closed by the
+        edit is not detected.
+        @p text must be valid UTF-16, see validUtf16(). */
+    int relex(const QString& text, std::vector<LexxedToken>& tokens,
+              const TextEdit& edit, int* first = nullptr) const;
+
+    /** Lexxes UTF-8 text, positions are byte offsets.
+        Matching always uses the compiled TokenDfa. */
+    template <class Container>
+    void tokenize(const Utf8Input& input, Container& output) const;
 
     template <class Container>
-    QString toString(const Container& vec);
+    QString toString(const QString& input, const Container& vec) const;
 
     const std::vector<Token>& tokens() const { return p_tokens; }
 
+    /** Name of the Token for a LexxedToken::kind(), or "EOF" */
+    const QString& name(int kind) const;
+
+    Mode mode() const { return p_mode; }
+    void setMode(Mode m) { p_mode = m; }
+
+    /** Threads used by tokenize(), 0 for QThread::idealThreadCount() */
+    int numThreads() const { return p_numThreads; }
+    void setNumThreads(int n) { p_numThreads = n; }
+
+    /** Lexxes the next token in @p input at or after @p pos,
+        moves @p pos behind it and adds the newlines passed to @p line.
+        Returns a K_EOF token at the end of @p input.
+        @p offset is added to the position of the returned token.
+        @p input must be valid UTF-16, see validUtf16(). */
+    LexxedToken next(const QString& input, int* pos, int* line,
+                     int offset = 0) const;
+
+    LexxedToken next(const Utf8Input& input, int* pos, int* line) const;
+
+    /** Returns the longest matching Token at @p pos, or NULL.
+        On equal length the Token added first wins.
+        Writes the length of the match to @p len. */
+    const Token* match(const QString& input, int pos, int* len) const;
+
+    /** Number of Tokens probed at a position starting with @p c
+        in M_PROBE mode */
+    int numCandidates(QChar c) const;
+
+    /** Builds the tables for mode() that are otherwise built on first
+        use. With @p utf8 also the TokenDfa that Utf8Input is lexxed
+        with in every mode. Afterwards the const methods may run in
+        several threads at once, if isThreadSafe(). */
+    void prepare(bool utf8 = false) const;
+    /** All Tokens are Token::isThreadSafe() */
+    bool isThreadSafe() const;
+
+    /** Returns @p input, or a copy in which unpaired surrogates are
+        replaced by U+FFFD, so positions stay the same */
+    static QString validUtf16(const QString& input);
+    /** @p input has no unpaired surrogates */
+    static bool isValidUtf16(const QString& input);
+
 private:
+    /** Inputs of at least this many chars per thread
+        are tokenized in parallel */
+    enum { P_MIN_CHUNK = 1 << 15 };
+
+    bool p_tokenizeParallel(const QString& input,
+                            std::vector<LexxedToken>& output,
+                            int numThreads) const;
+    void p_buildFirstIndex() const;
+    const TokenDfa& p_compiled() const;
+    friend QDataStream& operator << (QDataStream&, const Tokens&);
+    friend QDataStream& operator >> (QDataStream&, Tokens&);
+
+    const std::vector<int>& p_candidates(QChar c) const
+    {
+        if (p_first.empty())
+            p_buildFirstIndex();
+        return c.unicode() < 128 ? p_first[c.unicode()] : p_firstOther;
+    }
+
     std::vector<Token> p_tokens;
+    Mode p_mode;
+    int p_numThreads;
+    /** Token indices per leading ascii character, in order of adding */
+    mutable std::vector<std::vector<int>> p_first;
+    /** Tokens that can start with a non-ascii character */
+    mutable std::vector<int> p_firstOther;
+    mutable std::shared_ptr<const TokenDfa> p_dfa;
 };
 
+/** Writes the Tokens with the tables built so far, see prepare() */
+QDataStream& operator << (QDataStream& s, const Tokens& t);
+QDataStream& operator >> (QDataStream& s, Tokens& t);
+
 
 
 template <class Container>
-void Tokens::tokenize(const QString& input, Container& output)
+void Tokens::tokenize(const QString& text, Container& output,
+                      int numThreads) const
 {
-    int srcPos=0, srcLine=0;
-    for (int i=0; i<input.size(); ++i, ++srcPos)
+    // valid text is lexxed in place, without a shared copy
+    QString valid;
+    if (!isValidUtf16(text))
+        valid = validUtf16(text);
+    const QString& input = valid.isEmpty() ? text : valid;
+    if (numThreads != 1 && input.size() >= 2 * P_MIN_CHUNK)
     {
-        if (input[i] == '\n')
-            ++srcLine;
-
-        if (input[i].isSpace())
-            continue;
-
-        int mp = -1;
-        Token* best = nullptr;
-        QString value;
-        for (auto& t : p_tokens)
+        std::vector<LexxedToken> tokens;
+        if (p_tokenizeParallel(input, tokens, numThreads))
         {
-            int p = i;
-            if (t.isMatch(input, &p))
-            {
-                if (p > mp)
-                    mp = p, best = &t,
-                            value = input.mid(i, p-i);
-            }
+            std::copy(tokens.begin(), tokens.end(),
+                      std::inserter(output, output.end()));
+            return;
         }
-        if (best)
-            std::inserter(output, output.end())
-                = LexxedToken(best->name(), value,
-                              SourcePos(srcPos, srcLine));
+    }
 
+    int pos = 0, line = 0;
+    LexxedToken t;
+    do
+    {
+        t = next(input, &pos, &line);
+        std::inserter(output, output.end()) = t;
     }
+    while (t.kind() != K_EOF);
+}
 
-    std::inserter(output, output.end())
-        = LexxedToken("EOF", "", SourcePos(srcPos, srcLine));
+template <class Container>
+void Tokens::tokenize(const Utf8Input& input, Container& output) const
+{
+    int pos = 0, line = 0;
+    LexxedToken t;
+    do
+    {
+        t = next(input, &pos, &line);
+        std::inserter(output, output.end()) = t;
+    }
+    while (t.kind() != K_EOF);
 }
 
 template <class Container>
-QString Tokens::toString(const Container& vec)
+QString Tokens::toString(const QString& input, const Container& vec) const
 {
     QString s;
     for (const auto& t : vec)
         s += QString("%1(%2)@%3 ")
-                .arg(t.name()).arg(t.value()).arg(t.pos().pos());
+                .arg(name(t.kind())).arg(t.value(input).toString())
+                .arg(t.pos().pos());
     return s;
 }
 
@@ -0,0 +1,101 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <limits>
+
+#include <QFile>
+
+#include "Utf8Input.h"
+
+Utf8Input::Utf8Input(const QByteArray& utf8)
+    : p_bytes   (utf8)
+    , p_data    (p_bytes.constData())
+    , p_size    (p_bytes.size())
+{
+
+}
+
+bool Utf8Input::map(const QString& fileName)
+{
+    std::shared_ptr<QFile> file(new QFile(fileName));
+    if (!file->open(QIODevice::ReadOnly)
+        || file->size() > std::numeric_limits<int>::max())
+        return false;
+
+    p_bytes.clear();
+    p_file.reset();
+    p_data = nullptr;
+    p_size = file->size();
+    if (p_size == 0)
+        return true;
+
+    uchar* data = file->map(0, p_size);
+    if (!data)
+    {
+        p_size = 0;
+        return false;
+    }
+    p_file = file;
+    p_data = reinterpret_cast<const char*>(data);
+    return true;
+}
+
+uint Utf8Input::decode(int* pos) const
+{
+    const uchar* s = reinterpret_cast<const uchar*>(p_data);
+    int p = *pos;
+    uint c = s[p];
+    if (c < 0x80)
+    {
+        *pos = p + 1;
+        return c;
+    }
+
+    int len = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 0;
+    uint minimum = len == 4 ? 0x10000 : len == 3 ? 0x800 : 0x80;
+    if (len == 0 || c > 0xf4 || p + len > p_size)
+    {
+        *pos = p + 1;
+        return 0xfffd;
+    }
+    c &= 0x3f >> (len - 1);
+    for (int i=1; i<len; ++i)
+    {
+        if ((s[p+i] & 0xc0) != 0x80)
+        {
+            *pos = p + 1;
+            return 0xfffd;
+        }
+        c = (c << 6) | (s[p+i] & 0x3f);
+    }
+    if (c < minimum || c > 0x10ffff || (c >= 0xd800 && c < 0xe000))
+    {
+        *pos = p + 1;
+        return 0xfffd;
+    }
+    *pos = p + len;
+    return c;
+}
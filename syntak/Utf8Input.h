@@ -0,0 +1,77 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef UTF8INPUT_H
+#define UTF8INPUT_H
+
+#include <memory>
+
+#include <QString>
+#include <QByteArray>
+
+class QFile;
+
+/** UTF-8 encoded text, typically a memory-mapped file.
+
+    The lexxer works directly on the bytes, positions in LexxedToken and
+    SourcePos are byte offsets. Text is only converted to QString when
+    asked for with text(). Copies share the mapping. */
+class Utf8Input
+{
+public:
+    Utf8Input() : p_data(nullptr), p_size(0) { }
+    /** Uses the bytes of @p utf8 (implicitly shared) */
+    explicit Utf8Input(const QByteArray& utf8);
+
+    /** Maps the file into memory, returns false on error */
+    bool map(const QString& fileName);
+
+    bool isEmpty() const { return p_size == 0; }
+    const char* data() const { return p_data; }
+    int size() const { return p_size; }
+
+    QString text(int pos, int len) const
+        { return QString::fromUtf8(p_data + pos, len); }
+
+    /** Returns true if the byte at @p pos is ascii whitespace */
+    bool isAsciiSpace(int pos) const
+    {
+        const char c = p_data[pos];
+        return c == ' ' || (c >= 9 && c <= 13);
+    }
+
+    /** Decodes the code point at @p pos and moves @p pos behind it.
+        Malformed sequences decode to U+FFFD, one byte at a time. */
+    uint decode(int* pos) const;
+
+private:
+    std::shared_ptr<QFile> p_file;
+    QByteArray p_bytes;
+    const char* p_data;
+    int p_size;
+};
+
+#endif // UTF8INPUT_H
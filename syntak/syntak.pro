@@ -17,12 +17,32 @@ TEMPLATE = app
 
 SOURCES += \
     Tokens.cpp \
+    TokenDfa.cpp \
+    Scanner.cpp \
+    TokenStream.cpp \
+    Utf8Input.cpp \
     Rules.cpp \
+    ParseTable.cpp \
+    CompiledGrammar.cpp \
+    SyntaxTree.cpp \
     Parser.cpp \
+    ParsePool.cpp \
+    ParserGenerator.cpp \
     main.cpp
 
 HEADERS += \
     Tokens.h \
+    TokenDfa.h \
+    Scanner.h \
+    TokenStream.h \
+    Utf8Input.h \
     Rules.h \
-    Parser.h
+    ParseTable.h \
+    CompiledGrammar.h \
+    GrammarData.h \
+    SyntaxTree.h \
+    Parser.h \
+    ParsePool.h \
+    StaticGrammar.h \
+    ParserGenerator.h
 
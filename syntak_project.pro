@@ -2,8 +2,12 @@ TEMPLATE = subdirs
 
 SUBDIRS += \
 	syntak \
+	syntak-gen \
         tests
 
+# tests generate parsers with syntak-gen
+tests.depends = syntak-gen
+
 OTHER_FILES += \
 	LICENSE.txt \
 	README.md
\ No newline at end of file
@@ -0,0 +1,53 @@
+#-------------------------------------------------
+#
+# Parse time of the static and generated parsers
+# against the runtime engines
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = bench_grammar
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../../syntak ../test_math
+
+SOURCES += \
+    ../../syntak/Tokens.cpp \
+    ../../syntak/TokenDfa.cpp \
+    ../../syntak/Scanner.cpp \
+    ../../syntak/TokenStream.cpp \
+    ../../syntak/Utf8Input.cpp \
+    ../../syntak/Rules.cpp \
+    ../../syntak/ParseTable.cpp \
+    ../../syntak/CompiledGrammar.cpp \
+    ../../syntak/SyntaxTree.cpp \
+    ../../syntak/Parser.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../syntak/Tokens.h \
+    ../../syntak/TokenDfa.h \
+    ../../syntak/Scanner.h \
+    ../../syntak/TokenStream.h \
+    ../../syntak/Utf8Input.h \
+    ../../syntak/Rules.h \
+    ../../syntak/ParseTable.h \
+    ../../syntak/CompiledGrammar.h \
+    ../../syntak/GrammarData.h \
+    ../../syntak/SyntaxTree.h \
+    ../../syntak/Parser.h \
+    ../../syntak/StaticGrammar.h \
+    ../test_math/MathParser.h \
+    ../test_math/StaticMathParser.h
+
+# the parsers of test_math, generated by syntak-gen
+GRAMMARS += \
+    ../test_math/calc.syn \
+    ../test_math/calc_ops.syn
+
+include(../../syntak-gen/syntak-gen.pri)
@@ -0,0 +1,167 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <vector>
+
+#include <QString>
+#include <QtTest>
+#include "MathParser.h"
+#include "StaticMathParser.h"
+#include "calc_parser.h"
+#include "calc_ops_parser.h"
+
+/** Time of parsing MathParser::createProgram() with the runtime
+    engines, StaticGrammar::Parser and the parsers of syntak-gen,
+    all calling the callbacks of MathParser */
+class BenchGrammar : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchGrammar();
+
+    enum Engine
+    {
+        BACKTRACKING,
+        TABLE,
+        /** StaticGrammar::Parser with callbacks connected by name */
+        STATIC_CALLBACKS,
+        /** StaticGrammar::Parser with template actions */
+        STATIC_ACTIONS,
+        GENERATED,
+        /** syntak-gen from the grammar with an operator rule */
+        GENERATED_OPERATORS,
+        /** Tokens::tokenize() only, which all of them do first */
+        LEXXING
+    };
+
+private slots:
+
+    void benchParse_data();
+    void benchParse();
+
+private:
+    /** Parses p_program with @p engine, false on a parse error or
+        other variables than the runtime engine */
+    bool p_parse(Engine engine);
+
+    std::shared_ptr<const CompiledGrammar> p_grammar, p_opsGrammar;
+    QString p_program;
+    QMap<QString, int> p_expected;
+
+    MathParser p_runtime;
+    StaticMathParser p_typed;
+    StaticGrammar::Parser<StaticMath::program> p_connected;
+    MathParser p_byName;
+    MathParser p_generatedMath;
+    CalcParser p_generated;
+    MathParser p_opsMath;
+    CalcOpsParser p_generatedOps;
+    std::vector<LexxedToken> p_tokens;
+};
+
+BenchGrammar::BenchGrammar()
+    : p_grammar         (MathParser::createGrammar(false))
+    , p_opsGrammar      (MathParser::createGrammar(true))
+    , p_program         (MathParser::createProgram(2000))
+    , p_runtime         (p_grammar)
+    , p_typed           (p_grammar)
+    , p_connected       (p_grammar)
+    , p_byName          (p_grammar)
+    , p_generatedMath   (p_grammar)
+    , p_generated       (p_grammar->lexxer(), &p_grammar->rules())
+    , p_opsMath         (p_opsGrammar)
+    , p_generatedOps    (p_opsGrammar->lexxer(), &p_opsGrammar->rules())
+{
+    p_byName.connect(p_connected.actions());
+    p_generatedMath.connect(p_generated);
+    p_opsMath.connect(p_generatedOps);
+
+    MathParser reference(p_grammar);
+    reference.parse(p_program);
+    p_expected = reference.variables;
+}
+
+bool BenchGrammar::p_parse(Engine engine)
+{
+    switch (engine)
+    {
+        case BACKTRACKING:
+        case TABLE:
+            p_runtime.parser.setEngine(engine == TABLE
+                                       ? Parser::E_TABLE
+                                       : Parser::E_BACKTRACKING);
+            return p_runtime.parse(p_program).isOk()
+                    && p_runtime.variables == p_expected;
+        case STATIC_CALLBACKS:
+            p_byName.clear();
+            return p_connected.parse(p_program)
+                    && p_byName.variables == p_expected;
+        case STATIC_ACTIONS:
+            return p_typed.parse(p_program)
+                    && p_typed.math.variables == p_expected;
+        case GENERATED:
+            p_generatedMath.clear();
+            return p_generated.parse(p_program)
+                    && p_generatedMath.variables == p_expected;
+        case GENERATED_OPERATORS:
+            p_opsMath.clear();
+            return p_generatedOps.parse(p_program)
+                    && p_opsMath.variables == p_expected;
+        case LEXXING:
+            p_tokens.clear();
+            p_grammar->lexxer().tokenize(p_program, p_tokens);
+            return p_tokens.size() > 1;
+    }
+    return false;
+}
+
+void BenchGrammar::benchParse_data()
+{
+    QTest::addColumn<int>("engine");
+    QTest::newRow("backtracking") << int(BACKTRACKING);
+    QTest::newRow("table") << int(TABLE);
+    QTest::newRow("static with callbacks") << int(STATIC_CALLBACKS);
+    QTest::newRow("static with actions") << int(STATIC_ACTIONS);
+    QTest::newRow("generated") << int(GENERATED);
+    QTest::newRow("generated with operators") << int(GENERATED_OPERATORS);
+    QTest::newRow("lexxing") << int(LEXXING);
+}
+
+void BenchGrammar::benchParse()
+{
+    QFETCH(int, engine);
+    // warm up and check the results
+    QVERIFY(p_parse(Engine(engine)));
+    QBENCHMARK
+    {
+        p_parse(Engine(engine));
+    }
+}
+
+QTEST_APPLESS_MAIN(BenchGrammar)
+
+#include "main.moc"
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# Time and peak memory of lexxing a large text
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = bench_lexxer
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../../syntak
+
+SOURCES += \
+    ../../syntak/Tokens.cpp \
+    ../../syntak/TokenDfa.cpp \
+    ../../syntak/Scanner.cpp \
+    ../../syntak/Utf8Input.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../syntak/Tokens.h \
+    ../../syntak/TokenDfa.h \
+    ../../syntak/Scanner.h \
+    ../../syntak/Utf8Input.h \
+    ../../syntak/GrammarData.h
@@ -0,0 +1,148 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <vector>
+
+#include <QString>
+#include <QElapsedTimer>
+#include <QtTest>
+#include "Tokens.h"
+
+#ifdef Q_OS_UNIX
+#   include <sys/resource.h>
+#endif
+
+/** Time and peak memory of Tokens::tokenize() on a 10 MB text with
+    the tokens of the math grammar, most of them one character long */
+class BenchLexxer : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchLexxer();
+
+private slots:
+
+    // first, before the benchmarks raise the peak
+    void testPeakMemory();
+    void benchTokenize_data();
+    void benchTokenize();
+
+private:
+    Tokens p_lexxer;
+    QString p_text;
+};
+
+namespace {
+
+    /** Peak resident set size of the process in bytes, or -1 */
+    qint64 peakRss()
+    {
+#ifdef Q_OS_UNIX
+        rusage r;
+        if (getrusage(RUSAGE_SELF, &r) != 0)
+            return -1;
+#   ifdef Q_OS_MAC
+        return r.ru_maxrss;
+#   else
+        return qint64(r.ru_maxrss) * 1024;
+#   endif
+#else
+        return -1;
+#endif
+    }
+
+} // namespace
+
+BenchLexxer::BenchLexxer()
+{
+    p_lexxer << Token("plus", "+")
+             << Token("minus", "-")
+             << Token("mul", "*")
+             << Token("div", "/")
+             << Token("bopen", "(")
+             << Token("bclose", ")")
+             << Token("semicolon", ";")
+             << Token("dot", ".")
+             << Token("equals", "=")
+             << Token("print", "print")
+             << Token("letter", QRegExp("[a-z,A-Z]"))
+             << Token("digit", QRegExp("[0-9]"));
+
+    const QString line = "v%1 = (v%2 + %3) * 2 - v%2 / 3;\n";
+    for (int i=1; p_text.size() < 10000000; ++i)
+        p_text += line.arg(i).arg(i-1).arg(i % 7);
+}
+
+void BenchLexxer::benchTokenize_data()
+{
+    QTest::addColumn<int>("mode");
+    QTest::newRow("probe") << int(Tokens::M_PROBE);
+    QTest::newRow("compiled") << int(Tokens::M_COMPILED);
+}
+
+void BenchLexxer::benchTokenize()
+{
+    QFETCH(int, mode);
+    Tokens lex(p_lexxer);
+    lex.setMode(Tokens::Mode(mode));
+    lex.prepare();
+    std::vector<LexxedToken> tokens;
+    QBENCHMARK
+    {
+        tokens.clear();
+        lex.tokenize(p_text, tokens);
+    }
+    QVERIFY(tokens.size() > size_t(p_text.size() / 2));
+}
+
+void BenchLexxer::testPeakMemory()
+{
+    const qint64 before = peakRss();
+    if (before < 0)
+        QSKIP("peak memory is only measured on unix");
+
+    QElapsedTimer timer;
+    timer.start();
+    std::vector<LexxedToken> tokens;
+    p_lexxer.tokenize(p_text, tokens);
+    const qint64 ns = timer.nsecsElapsed();
+    const qint64 grown = peakRss() - before;
+
+    // the tokens are the only allocation, one flat vector
+    const qint64 storage = qint64(tokens.capacity()) * sizeof(LexxedToken);
+    qDebug() << p_text.size() << "chars," << tokens.size() << "tokens:"
+             << ns / 1000000 << "ms, peak RSS grew by"
+             << grown / (1 << 20) << "MB, tokens take"
+             << storage / (1 << 20) << "MB";
+    QCOMPARE(int(sizeof(LexxedToken)), 16);
+    // vector growth keeps the old and the new array for a moment
+    QVERIFY(grown <= storage * 2 + (16 << 20));
+}
+
+QTEST_APPLESS_MAIN(BenchLexxer)
+
+#include "main.moc"
@@ -0,0 +1,44 @@
+#-------------------------------------------------
+#
+# Throughput of ParsePool over the number of threads
+#
+#-------------------------------------------------
+
+QT       += core testlib
+QT       -= gui
+
+TARGET = bench_parsepool
+CONFIG   += c++11 console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+INCLUDEPATH += ../../syntak
+
+SOURCES += \
+    ../../syntak/Tokens.cpp \
+    ../../syntak/TokenDfa.cpp \
+    ../../syntak/Scanner.cpp \
+    ../../syntak/TokenStream.cpp \
+    ../../syntak/Utf8Input.cpp \
+    ../../syntak/Rules.cpp \
+    ../../syntak/ParseTable.cpp \
+    ../../syntak/CompiledGrammar.cpp \
+    ../../syntak/SyntaxTree.cpp \
+    ../../syntak/Parser.cpp \
+    ../../syntak/ParsePool.cpp \
+    main.cpp
+
+HEADERS += \
+    ../../syntak/Tokens.h \
+    ../../syntak/TokenDfa.h \
+    ../../syntak/Scanner.h \
+    ../../syntak/TokenStream.h \
+    ../../syntak/Utf8Input.h \
+    ../../syntak/Rules.h \
+    ../../syntak/ParseTable.h \
+    ../../syntak/CompiledGrammar.h \
+    ../../syntak/GrammarData.h \
+    ../../syntak/SyntaxTree.h \
+    ../../syntak/Parser.h \
+    ../../syntak/ParsePool.h
@@ -0,0 +1,180 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#include <QString>
+#include <QThread>
+#include <QtTest>
+#include "ParsePool.h"
+
+/** Throughput of ParsePool::parseMany() over the number of threads,
+    on many small expressions */
+class BenchParsePool : public QObject
+{
+    Q_OBJECT
+
+public:
+    BenchParsePool();
+
+private slots:
+
+    void benchParseMany_data();
+    void benchParseMany();
+    void testScaling();
+
+private:
+    /** Parses all inputs with @p threads workers and checks the
+        results, returns the documents per second of the best run */
+    double p_parse(int threads, int runs);
+
+    std::shared_ptr<const CompiledGrammar> p_grammar;
+    QStringList p_inputs;
+    std::vector<qint64> p_expected;
+    /** Evaluation stack per worker */
+    std::vector<std::vector<qint64>> p_stacks;
+    ParsePool p_pool;
+};
+
+namespace {
+
+    std::shared_ptr<const CompiledGrammar> createGrammar()
+    {
+        Tokens lex;
+        lex << Token("plus", "+")
+            << Token("mul", "*")
+            << Token("bopen", "(")
+            << Token("bclose", ")")
+            << Token("semicolon", ";")
+            << Token("num", QRegExp("[0-9]+"));
+        Rules rules;
+        rules.addTokens(lex);
+        rules.createAnd("program",   "expr", "semicolon");
+        rules.createOperators("expr", "prim", QList<Operator>()
+            << Operator("plus", 1, Operator::O_LEFT, "add")
+            << Operator("mul",  2, Operator::O_LEFT, "mul_prim"));
+        rules.createOr( "prim",      "num", "paren");
+        rules.createAnd("paren",     "bopen", "expr", "bclose");
+        return CompiledGrammar::create(lex, rules);
+    }
+
+} // namespace
+
+BenchParsePool::BenchParsePool()
+    : p_grammar (createGrammar())
+    , p_stacks  (std::max(1, QThread::idealThreadCount()))
+    , p_pool    (p_grammar)
+{
+    for (int i=0; i<100000; ++i)
+    {
+        p_inputs << QString("%1 + %2 * (%3 + 1) * 2;")
+                    .arg(i).arg(i % 13).arg(i % 7);
+        p_expected.push_back(i + (i % 13) * (i % 7 + 1) * 2);
+    }
+
+    p_pool.setInit([this](Parser& parser, int worker)
+    {
+        auto& stack = p_stacks[worker];
+        parser.connect("num", [&](const ParsedToken& t)
+        {
+            stack.push_back(t.textRef().toInt());
+        });
+        auto binary = [&](bool mul)
+        {
+            const qint64 b = stack.back();
+            stack.pop_back();
+            stack.back() = mul ? stack.back() * b : stack.back() + b;
+        };
+        parser.connect("add", [=](const ParsedToken&) { binary(false); });
+        parser.connect("mul_prim", [=](const ParsedToken&) { binary(true); });
+    });
+}
+
+double BenchParsePool::p_parse(int threads, int runs)
+{
+    auto result = [this](Parser&, int worker)
+    {
+        const qint64 v = p_stacks[worker].back();
+        p_stacks[worker].clear();
+        return v;
+    };
+
+    p_pool.setNumThreads(threads);
+    double best = 0.;
+    for (int run = 0; run < runs; ++run)
+    {
+        const auto values = p_pool.parseMany<qint64>(p_inputs, result);
+        if (values != p_expected)
+            return 0.;
+        best = std::max(best, p_pool.documentsPerSecond());
+    }
+    return best;
+}
+
+void BenchParsePool::benchParseMany_data()
+{
+    QTest::addColumn<int>("threads");
+    for (int threads = 1; threads < QThread::idealThreadCount();
+         threads *= 2)
+        QTest::newRow(qPrintable(QString("%1 threads").arg(threads)))
+                << threads;
+    QTest::newRow(qPrintable(QString("%1 threads")
+                             .arg(QThread::idealThreadCount())))
+            << QThread::idealThreadCount();
+}
+
+void BenchParsePool::benchParseMany()
+{
+    QFETCH(int, threads);
+    // warm up the workers' Parsers
+    QVERIFY(p_parse(threads, 1) > 0.);
+    QBENCHMARK
+    {
+        QVERIFY(p_parse(threads, 1) > 0.);
+    }
+}
+
+void BenchParsePool::testScaling()
+{
+    const int ideal = QThread::idealThreadCount();
+    const double single = p_parse(1, 3);
+    QVERIFY(single > 0.);
+    qDebug() << "1 thread:" << int(single) << "docs/s";
+    if (ideal < 2)
+        QSKIP("scaling needs more than one core");
+
+    for (int threads = 2; threads <= ideal; threads *= 2)
+    {
+        const double speedup = p_parse(threads, 3) / single;
+        qDebug() << threads << "threads: speedup" << speedup;
+        // near-linear, at least half of every core
+        QVERIFY2(speedup >= threads * 0.5,
+                 qPrintable(QString("speedup %1 on %2 threads")
+                            .arg(speedup).arg(threads)));
+    }
+}
+
+QTEST_APPLESS_MAIN(BenchParsePool)
+
+#include "main.moc"
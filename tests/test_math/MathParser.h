@@ -39,11 +39,18 @@ SOFTWARE.
 class MathParser
 {
 public:
-    MathParser() { init(); }
+    /** With @p operators, expr is one Rules::createOperators() rule
+        instead of a cascade of term and factor rules */
+    explicit MathParser(bool operators = false)
+        : MathParser(createGrammar(operators)) { }
+    /** Parses with a @p grammar of createGrammar(),
+        which may be shared with MathParsers in other threads */
+    explicit MathParser(std::shared_ptr<const CompiledGrammar> grammar)
+        : parser(grammar) { connect(); }
 
     struct Node
     {
-        Node(const ParsedToken& t) : t(t) { }
+        Node(const ParsedToken& t) : t(t), value(0) { }
         Node(int v) : value(v) { }
         ParsedToken t;
         int value;
@@ -54,7 +61,8 @@ public:
     QList<Node> stack;
     QMap<QString, int> variables;
 
-    void init()
+    static std::shared_ptr<const CompiledGrammar>
+        createGrammar(bool operators)
     {
         Tokens lex;
 
@@ -75,11 +83,22 @@ public:
         Rules rules;
         rules.addTokens(lex);
         rules.createOr( "op1",          "plus" , "minus");
-        rules.createOr( "op2",          "mul" , "div");
-        rules.createAnd("op1_term",     "op1" , "term");
-        rules.createAnd("op2_factor",   "op2" , "factor");
-        rules.createAnd("expr",         "term" , "[op1_term]*");
-        rules.createAnd("term",         "factor" , "[op2_factor]*");
+        if (operators)
+        {
+            rules.createOperators("expr", "factor", QList<Operator>()
+                << Operator("plus",  1, Operator::O_LEFT, "op1_term")
+                << Operator("minus", 1, Operator::O_LEFT, "op1_term")
+                << Operator("mul",   2, Operator::O_LEFT, "op2_factor")
+                << Operator("div",   2, Operator::O_LEFT, "op2_factor"));
+        }
+        else
+        {
+            rules.createOr( "op2",          "mul" , "div");
+            rules.createAnd("op1_term",     "op1" , "term");
+            rules.createAnd("op2_factor",   "op2" , "factor");
+            rules.createAnd("expr",         "term" , "[op1_term]*");
+            rules.createAnd("term",         "factor" , "[op2_factor]*");
+        }
         rules.createOr( "factor",       "int_expr");
         rules.createAnd("quoted_expr",  "bopen" , "expr" , "bclose");
         rules.createAnd("uint",         "digit" , "[digit]*");
@@ -94,73 +113,127 @@ public:
         rules.createAnd("ident",        "letter" , "[alnum]*");
         rules.createAnd("signed_ident", "[op1]" , "ident");
         rules.createOr ("alnum",        "letter" , "digit");
+        rules.setSyncTokens("s_statement", QStringList() << "semicolon");
+
+
+        //PRINT(rules.toDefinitionString());
 
+        return CompiledGrammar::create(lex, rules);
+    }
 
-        rules.check();
+    /** @p statements assignments of signed, nested expressions
+        with a print() after every fifth */
+    static QString createProgram(int statements)
+    {
+        QString program;
+        for (int i=0; i<statements; ++i)
+            program += QString("v%1 = -%2 * (v%3 + %4) - v%5 / 2;%6\n")
+                       .arg(i).arg(i % 10).arg(i / 2).arg(i % 7).arg(i / 3)
+                       .arg(i % 5 ? "" : " print(v1);");
+        return program;
+    }
 
 #define DO_STACK
 
-        rules.connect("assignment", 0, [=](const ParsedToken& t)
-        {
-            emits << t;
-            stack << t;
-        });
-        rules.connect("assignment", [=](const ParsedToken& t)
-        {
-            emits << t;
-#ifdef DO_STACK
-            int v = takeLastInt();
-            auto p = stack.takeLast();
-            variables.insert(p.t.text(), v);
-            stack << Node(v);
-#endif
-        });
+    void connect() { connect(parser); }
+
+    /** Connects the callbacks to @p target, a Parser or
+        a StaticGrammar::Callbacks */
+    template <class Target>
+    void connect(Target& target)
+    {
+        target.connect("assignment", 0, [=](const ParsedToken& t)
+            { onAssignmentIdent(t); });
+        target.connect("assignment", [=](const ParsedToken& t)
+            { onAssignment(t); });
         // int in factor
-        rules.connect("factor", 0, [=](const ParsedToken& t)
-        {
-            emits << t;
+        target.connect("factor", 0, [=](const ParsedToken& t)
+            { onFactor(t); });
+        target.connect("op1_term", [=](const ParsedToken& t)
+            { onOp1Term(t); });
+        target.connect("op2_factor", [=](const ParsedToken& t)
+            { onOp2Factor(t); });
+    }
+
+    void onAssignmentIdent(const ParsedToken& t)
+    {
+        emits << t;
+        stack << t;
+    }
+
+    void onAssignment(const ParsedToken& t)
+    {
+        emits << t;
 #ifdef DO_STACK
-            if (!t.text().startsWith("("))
-                stack << t;
+        int v = takeLastInt();
+        auto p = stack.takeLast();
+        variables.insert(p.t.text(), v);
+        stack << Node(v);
 #endif
-        });
-        rules.connect("op1_term", [=](const ParsedToken& t)
-        {
-            emits << t;
+    }
+
+    void onFactor(const ParsedToken& t)
+    {
+        emits << t;
 #ifdef DO_STACK
-            int p2 = takeLastInt(), p1 = takeLastInt();
-            if (t.text().startsWith("+"))
-                stack << Node(p1 + p2);
-            else
-                stack << Node(p1 - p2);
+        if (!t.text().startsWith("("))
+            stack << t;
 #endif
-        });
-        rules.connect("op2_factor", [=](const ParsedToken& t)
-        {
-            emits << t;
+    }
+
+    void onOp1Term(const ParsedToken& t)
+    {
+        emits << t;
 #ifdef DO_STACK
-            int p2 = takeLastInt(), p1 = takeLastInt();
-            if (t.text().startsWith("*"))
-                stack << Node(p1 * p2);
-            else
-                stack << Node(p1 / p2);
+        int p2 = takeLastInt(), p1 = takeLastInt();
+        if (t.text().startsWith("+"))
+            stack << Node(p1 + p2);
+        else
+            stack << Node(p1 - p2);
 #endif
-        });
-
-        //PRINT(rules.toDefinitionString());
-
-        parser.setLexxer(lex);
-        parser.setRules(rules);
+    }
 
+    void onOp2Factor(const ParsedToken& t)
+    {
+        emits << t;
+#ifdef DO_STACK
+        int p2 = takeLastInt(), p1 = takeLastInt();
+        if (t.text().startsWith("*"))
+            stack << Node(p1 * p2);
+        else
+            stack << Node(p1 / p2);
+#endif
     }
 
-    void parse(const QString& text)
+    void clear()
     {
         emits.clear();
         stack.clear();
         variables.clear();
+    }
 
-        parser.parse(text);
+    const ParseResult& parse(const QString& text)
+    {
+        clear();
+        return parser.parse(text);
+    }
+
+    const ParseResult& parse(const QString& text, const TextEdit& edit)
+    {
+        clear();
+        return parser.parse(text, edit);
+    }
+
+    const ParseResult& parse(QIODevice* device)
+    {
+        clear();
+        return parser.parse(device);
+    }
+
+    const ParseResult& parse(const Utf8Input& input)
+    {
+        clear();
+        return parser.parse(input);
     }
 
     void print()
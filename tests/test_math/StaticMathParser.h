@@ -0,0 +1,118 @@
+/***************************************************************************
+
+MIT License
+
+Copyright (c) 2016 stefan berke
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+
+****************************************************************************/
+
+#ifndef SYNTAKSRC_TESTS_TEST_MATH_STATICMATHPARSER_H
+#define SYNTAKSRC_TESTS_TEST_MATH_STATICMATHPARSER_H
+
+#include "StaticGrammar.h"
+#include "MathParser.h"
+
+/** The grammar of MathParser::createGrammar(false) as types */
+namespace StaticMath
+{
+    using StaticGrammar::And;
+    using StaticGrammar::Or;
+    using StaticGrammar::Opt;
+    using StaticGrammar::Repeat;
+
+    // the Token names of MathParser::createGrammar()
+    SYNTAK_TOKEN(plus);
+    SYNTAK_TOKEN(minus);
+    SYNTAK_TOKEN(mul);
+    SYNTAK_TOKEN(div);
+    SYNTAK_TOKEN(bopen);
+    SYNTAK_TOKEN(bclose);
+    SYNTAK_TOKEN(semicolon);
+    SYNTAK_TOKEN(dot);
+    SYNTAK_TOKEN(equals);
+    SYNTAK_TOKEN(print);
+    SYNTAK_TOKEN(letter);
+    SYNTAK_TOKEN(digit);
+
+    struct expr;
+    struct term;
+    struct factor;
+
+    SYNTAK_RULE(op1,            Or<plus, minus>);
+    SYNTAK_RULE(op2,            Or<mul, div>);
+    SYNTAK_RULE(op1_term,       And<op1, term>);
+    SYNTAK_RULE(op2_factor,     And<op2, factor>);
+    SYNTAK_RULE(expr,           And<term, Opt<Repeat<op1_term>>>);
+    SYNTAK_RULE(term,           And<factor, Opt<Repeat<op2_factor>>>);
+    SYNTAK_RULE(alnum,          Or<letter, digit>);
+    SYNTAK_RULE(ident,          And<letter, Opt<Repeat<alnum>>>);
+    SYNTAK_RULE(uint,           And<digit, Opt<Repeat<digit>>>);
+    SYNTAK_RULE(quoted_expr,    And<bopen, expr, bclose>);
+    SYNTAK_RULE(uint_expr,      Or<uint, ident, quoted_expr>);
+    SYNTAK_RULE(int_expr,       And<Opt<op1>, uint_expr>);
+    SYNTAK_RULE(factor,         Or<int_expr>);
+    SYNTAK_RULE(assignment,     And<ident, equals, expr>);
+    SYNTAK_RULE(print_call,     And<print, bopen, expr, bclose>);
+    SYNTAK_RULE(statement,      Or<assignment, print_call>);
+    SYNTAK_RULE(s_statement,    And<statement, semicolon>);
+    SYNTAK_RULE(program,        And<s_statement, Opt<Repeat<s_statement>>>);
+}
+
+/** MathParser with the callbacks as template actions
+    of a StaticGrammar::Parser */
+class StaticMathParser
+{
+public:
+    /** Calls the handlers of MathParser */
+    struct Actions
+    {
+        typedef StaticGrammar::Sub<0> Sub0;
+        void operator()(StaticMath::assignment, Sub0, const ParsedToken& t)
+            { math->onAssignmentIdent(t); }
+        void operator()(StaticMath::assignment, const ParsedToken& t)
+            { math->onAssignment(t); }
+        void operator()(StaticMath::factor, Sub0, const ParsedToken& t)
+            { math->onFactor(t); }
+        void operator()(StaticMath::op1_term, const ParsedToken& t)
+            { math->onOp1Term(t); }
+        void operator()(StaticMath::op2_factor, const ParsedToken& t)
+            { math->onOp2Factor(t); }
+        MathParser* math;
+    };
+
+    /** @p grammar of MathParser::createGrammar(false) provides
+        the lexxer and the Rules of ParsedToken::rule() */
+    explicit StaticMathParser(std::shared_ptr<const CompiledGrammar> grammar)
+        : math(grammar), parser(grammar)
+        { parser.actions().math = &math; }
+
+    /** Holds the results, see MathParser::emits */
+    MathParser math;
+    StaticGrammar::Parser<StaticMath::program, Actions> parser;
+
+    bool parse(const QString& text)
+    {
+        math.clear();
+        return parser.parse(text);
+    }
+};
+
+#endif // SYNTAKSRC_TESTS_TEST_MATH_STATICMATHPARSER_H
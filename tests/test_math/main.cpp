@@ -24,13 +24,47 @@ SOFTWARE.
 
 ****************************************************************************/
 
+#include <atomic>
+#include <thread>
+
 #include <QString>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QBuffer>
+#include <QTemporaryFile>
 #include <QtTest>
 #include "MathParser.h"
+#include "Scanner.h"
+#include "ParsePool.h"
+#include "StaticMathParser.h"
+#include "ParserGenerator.h"
+#include "calc_parser.h"
+#include "calc_ops_parser.h"
 
 //using namespace Syntak;
 
 
+// counts heap allocations while p_countAllocs is set
+#if defined(__GNUC__) && __GNUC__ >= 11 && !defined(__clang__)
+#   pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static int p_numAllocs = 0;
+static bool p_countAllocs = false;
+
+void* operator new(size_t size)
+{
+    if (p_countAllocs)
+        ++p_numAllocs;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
 
 namespace QTest {
 
@@ -49,7 +83,7 @@ namespace QTest {
     template <>
     char* toString(const LexxedToken& p)
     {
-        return toString(p.name());
+        return toString(QString("%1@%2").arg(p.kind()).arg(p.pos().pos()));
     }
 
     template <>
@@ -71,6 +105,32 @@ public:
 private slots:
 
     void testBasics();
+    void testCompiledLexxer();
+    void testMultiLineTokens();
+    void testLexxerScaling();
+    void testLexxedTokenSize();
+    void testFirstCharIndex();
+    void testScanner();
+    void testStreaming();
+    void testUtf8Input();
+    void testParallelLexxer();
+    void testRelex();
+    void testRuleIds();
+    void testPackrat();
+    void testFirstSets();
+    void testParseTable();
+    void testDeepNesting();
+    void testOperators();
+    void testSyntaxTree();
+    void testDeferCallbacks();
+    void testNoAllocations();
+    void testSharedGrammar();
+    void testParseMany();
+    void testErrorRecovery();
+    void testIncremental();
+    void testGrammarData();
+    void testStaticGrammar();
+    void testGeneratedParser();
 };
 
 void SyntakTestMath::testBasics()
@@ -100,6 +160,1448 @@ void SyntakTestMath::testBasics()
 
 }
 
+namespace {
+
+    QString lexxed(Tokens& lex, const QString& text)
+    {
+        std::vector<LexxedToken> tokens;
+        lex.tokenize(text, tokens);
+        QString s;
+        for (const auto& t : tokens)
+            s += QString("%1(%2)@%3 ")
+                    .arg(lex.name(t.kind())).arg(t.value(text).toString())
+                    .arg(t.pos().toString());
+        return s;
+    }
+
+} // namespace
+
+void SyntakTestMath::testCompiledLexxer()
+{
+    Tokens lex;
+    lex << Token("equals", "=")
+        << Token("compare", "==")
+        << Token("print", "print")
+        << Token("ident", QRegExp("[a-z_][a-z_0-9]*"))
+        << Token("hex", QRegExp("0x[0-9a-fA-F]{1,4}"))
+        << Token("number", QRegExp("\\d+(\\.\\d+)?"))
+        << Token("string", QRegExp("\"([^\"\\\\]|\\\\.)*\""))
+        << Token("arrow", QRegExp("->|=>"))
+        << Token("minus", "-");
+
+    const QString text =
+            "print x == 0x1f;\n"
+            "printer = \"a \\\"b\\\"\" -> 3.14 => y\n"
+            "  _a1=-2 \"\u00fcber\" \u00e4 pri";
+
+    Tokens compiled(lex);
+    compiled.setMode(Tokens::M_COMPILED);
+    QCOMPARE(lexxed(compiled, text), lexxed(lex, text));
+
+    // the math grammar must behave the same with the compiled lexxer
+    MathParser p;
+    p.parser.setLexxer(p.parser.lexxer(), Tokens::M_COMPILED);
+    SYNTAK__COMP( 1+2*3 );
+    SYNTAK__COMP( ((((((1+2)*3+4)*5+6)*7+8*9+10)*11+12)*13+14)*15 );
+}
+
+void SyntakTestMath::testMultiLineTokens()
+{
+    // '.' matches newlines, '$' only the end of the text, like in QRegExp
+    Tokens lex;
+    lex << Token("block", QRegExp("<<.*>>"))
+        << Token("ident", QRegExp("[a-z]+"))
+        << Token("rest", QRegExp("@.*$"));
+
+    const QString text = "a <<b\n\nc>> d\ne @tail\n";
+    std::vector<LexxedToken> tokens;
+    lex.tokenize(text, tokens);
+    QCOMPARE(int(tokens.size()), 6);
+    QCOMPARE(tokens[1].value(text).toString(), QString("<<b\n\nc>>"));
+    QCOMPARE(tokens[2].pos().line(), 2);
+    QCOMPARE(tokens[4].value(text).toString(), QString("@tail\n"));
+
+    Tokens compiled(lex);
+    compiled.setMode(Tokens::M_COMPILED);
+    QCOMPARE(lexxed(compiled, text), lexxed(lex, text));
+}
+
+void SyntakTestMath::testLexxerScaling()
+{
+    MathParser p;
+    Tokens lex = p.parser.lexxer();
+    // regexps that rarely match, a search for them would run
+    // to the end of the text at every position
+    lex << Token("string", QRegExp("\"[^\"]*\""))
+        << Token("comment", QRegExp("//[^\\n]*"));
+    const QString line = "result= (12 + ab) * -3;\n",
+                  last = "s = \"x\"; // end\n";
+
+    for (const Token& t : lex.tokens())
+        QVERIFY(t.isAnchored());
+    QVERIFY(!Token("w", QRegExp("*.txt", Qt::CaseSensitive,
+                                QRegExp::Wildcard)).isAnchored());
+
+    // the same number of failing probes costs the same in a text
+    // 8 times as long, a search would run to its end every time
+    const Token& rare = lex.tokens()[lex.tokens().size() - 2];
+    qint64 probeTime[2];
+    for (int i=0; i<2; ++i)
+    {
+        const QString text = line.repeated(i ? 8000 : 1000);
+        probeTime[i] = -1;
+        for (int run=0; run<3; ++run)
+        {
+            int matches = 0;
+            QElapsedTimer timer;
+            timer.start();
+            for (int k=0; k<4000; ++k)
+            {
+                int pos = int(qint64(text.size()) * k / 4000);
+                matches += rare.isMatch(text, &pos);
+            }
+            const qint64 ns = timer.nsecsElapsed();
+            QCOMPARE(matches, 0);
+            if (probeTime[i] < 0 || ns < probeTime[i])
+                probeTime[i] = ns;
+        }
+    }
+    PRINT("4000 probes in " << line.size() * 1000 << " chars: "
+          << probeTime[0] / 1000 << "us, in " << line.size() * 8000
+          << " chars: " << probeTime[1] / 1000 << "us");
+    QVERIFY(probeTime[1] < probeTime[0] * 4);
+
+    std::vector<LexxedToken> tokens;
+    for (int n = 1; n <= 8; n *= 2)
+    {
+        const QString text = line.repeated(2000 * n) + last;
+        tokens.clear();
+        QElapsedTimer timer;
+        timer.start();
+        lex.tokenize(text, tokens);
+        const qint64 ns = timer.nsecsElapsed();
+
+        // Tokens probed at the start of each token
+        qint64 probes = 0;
+        for (const LexxedToken& t : tokens)
+            if (t.kind() != Tokens::K_EOF)
+                probes += lex.numCandidates(text[t.pos().pos()]);
+        PRINT(text.size() << " chars lexxed in " << ns / 1000 << "us, "
+              << probes << " probes");
+        QCOMPARE(int(tokens.size()), 18 * 2000 * n + 6);
+        // the rare tokens only where they can start
+        QVERIFY(probes < qint64(tokens.size()) * 2);
+    }
+}
+
+void SyntakTestMath::testLexxedTokenSize()
+{
+    // tokens are offsets into the text, no strings
+    QCOMPARE(int(sizeof(LexxedToken)), 16);
+}
+
+void SyntakTestMath::testFirstCharIndex()
+{
+    MathParser p;
+    Tokens lex = p.parser.lexxer();
+    QCOMPARE(lex.numCandidates('+'), 1);
+    QCOMPARE(lex.numCandidates('7'), 1);
+    QCOMPARE(lex.numCandidates('x'), 1);
+    // print, letter
+    QCOMPARE(lex.numCandidates('p'), 2);
+    QCOMPARE(lex.numCandidates(' '), 0);
+    QCOMPARE(lex.numCandidates(QChar(0xe4)), 0);
+
+    // tokens that can not be analyzed are probed everywhere
+    lex << Token("word_x", QRegExp("x\\b"));
+    QCOMPARE(lex.numCandidates('+'), 2);
+    QCOMPARE(lex.numCandidates(QChar(0xe4)), 1);
+}
+
+void SyntakTestMath::testScanner()
+{
+    // whitespace runs of random length, broken by
+    // non-ascii spaces, control chars and text
+    const QChar chars[] = { ' ', '\t', '\n', '\r', '\v', '\f',
+                            QChar(0xa0), QChar(8), QChar(14), 'x' };
+    QString text;
+    quint32 seed = 1;
+    for (int i=0; i<3000; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        int r = (seed >> 16) % 64;
+        text += chars[r < 60 ? r % 6 : r - 54];
+    }
+    QString other = text;
+    other[1500] = 'y';
+
+    const Scanner::Isa best = Scanner::isa();
+    for (int isa = Scanner::I_SSE2; isa <= Scanner::I_AVX2; ++isa)
+    {
+        if (!Scanner::isSupported(Scanner::Isa(isa)))
+            continue;
+        for (int pos=0; pos<text.size(); ++pos)
+        {
+            const int len = std::min((pos * 7) % 50, text.size() - pos);
+            int linesScalar = 0, linesSimd = 0;
+
+            Scanner::setIsa(Scanner::I_SCALAR);
+            int scalar = Scanner::skipSpace(text.constData(), pos, text.size(),
+                                            &linesScalar);
+            bool eqScalar = Scanner::equal(text.constData() + pos,
+                                           other.constData() + pos, len);
+
+            Scanner::setIsa(Scanner::Isa(isa));
+            int simd = Scanner::skipSpace(text.constData(), pos, text.size(),
+                                          &linesSimd);
+            bool eqSimd = Scanner::equal(text.constData() + pos,
+                                         other.constData() + pos, len);
+
+            QCOMPARE(simd, scalar);
+            QCOMPARE(linesSimd, linesScalar);
+            QCOMPARE(eqSimd, eqScalar);
+        }
+    }
+    Scanner::setIsa(best);
+
+    // switching while another thread scans
+    int expected = 0;
+    const int end = Scanner::skipSpace(text.constData(), 0, text.size(),
+                                       &expected);
+    std::atomic<bool> done(false);
+    std::thread switcher([&]()
+    {
+        for (int i=0; !done; ++i)
+            Scanner::setIsa(i % 2 ? Scanner::I_SCALAR : best);
+    });
+    bool same = true;
+    for (int i=0; i<2000; ++i)
+    {
+        int lines = 0;
+        same = same && Scanner::skipSpace(text.constData(), 0, text.size(),
+                                          &lines) == end
+                    && lines == expected;
+    }
+    done = true;
+    switcher.join();
+    Scanner::setIsa(best);
+    QVERIFY(same);
+}
+
+void SyntakTestMath::testStreaming()
+{
+    QString text = "v0 = 1;\n";
+    for (int i=1; i<5000; ++i)
+        text += QString("v%1 = (v%2 + %3) * 2 - v%2 / 3;\n")
+                .arg(i).arg(i-1).arg(i % 7);
+
+    MathParser p;
+    p.parse(text);
+    auto expected = p.variables;
+
+    QByteArray utf8 = text.toUtf8();
+    QBuffer buffer(&utf8);
+    buffer.open(QIODevice::ReadOnly);
+    p.parse(&buffer);
+    QCOMPARE(p.variables, expected);
+    QVERIFY(p.parser.lexxedTokens().empty());
+
+    // only about one statement is kept
+    const TokenStream* stream = p.parser.tokenStream();
+    PRINT("streamed " << text.size() << " chars, max "
+          << stream->maxBufferedTokens() << " tokens, "
+          << stream->maxBufferedText() << " chars buffered");
+    QVERIFY(stream->maxBufferedTokens() < 100);
+    QVERIFY(stream->maxBufferedText() < text.size() / 2);
+    QVERIFY(!stream->isTruncated());
+
+    // tiny chunks, tokens across chunk borders
+    int pos = 0;
+    p.stack.clear();
+    p.variables.clear();
+    p.parser.parse([&]() { pos += 7; return text.mid(pos - 7, 7); });
+    QCOMPARE(p.variables, expected);
+
+    // positions are int, longer input ends at the limit
+    pos = 0;
+    TokenStream limited(p.parser.lexxer(),
+                        [&]() { pos += 7; return text.mid(pos - 7, 7); });
+    limited.setTextLimit(100);
+    size_t n = 0;
+    while (limited.has(n) && limited.at(n).kind() != Tokens::K_EOF)
+        limited.release(n++);
+    QVERIFY(limited.isTruncated());
+    QCOMPARE(limited.textEnd(), 100);
+    QCOMPARE(limited.at(n).pos().pos(), 100);
+}
+
+void SyntakTestMath::testUtf8Input()
+{
+    Tokens lex;
+    lex << Token("arrow", QString::fromUtf8("\u2192"))
+        << Token("smile", QString::fromUtf8("\U0001F600"))
+        << Token("word_x", QRegExp("x\\b"))
+        << Token("ident", QRegExp("\\w+"))
+        << Token("string", QRegExp("\"[^\"]*\""))
+        << Token("plus", "+");
+
+    const QString text = QString::fromUtf8(
+            "gr\u00fc\u00dfe \u2192 \"\u20ac \U0001F600\"\n"
+            "\u00a0x+\U0001F600\u2028 x \u03b1\u03b2\n\n+");
+    const QByteArray utf8 = text.toUtf8();
+
+    std::vector<LexxedToken> tokens;
+    lex.tokenize(Utf8Input(utf8), tokens);
+
+    QString lexxed;
+    for (const LexxedToken& t : tokens)
+        lexxed += QString("%1(%2)@%3 ")
+                .arg(lex.name(t.kind()))
+                .arg(Utf8Input(utf8).text(t.pos().pos(), t.length()))
+                .arg(t.pos().line());
+    QCOMPARE(lexxed, QString::fromUtf8(
+                 "ident(gr\u00fc\u00dfe)@0 arrow(\u2192)@0 "
+                 "string(\"\u20ac \U0001F600\")@0 "
+                 "word_x(x)@1 plus(+)@1 smile(\U0001F600)@1 "
+                 "word_x(x)@1 ident(\u03b1\u03b2)@1 plus(+)@3 EOF()@3 "));
+
+    // math grammar from a mapped file
+    QString program;
+    for (int i=1; i<100; ++i)
+        program += QString("v%1 = %1 * (2 + v%2);\n").arg(i).arg(i-1);
+    MathParser p;
+    p.parse("v0 = 1;\n" + program);
+    auto expected = p.variables;
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(("v0 = 1;\n" + program).toUtf8());
+    file.close();
+
+    Utf8Input input;
+    QVERIFY(input.map(file.fileName()));
+    p.variables.clear();
+    p.stack.clear();
+    p.parser.parse(input);
+    QCOMPARE(p.variables, expected);
+}
+
+void SyntakTestMath::testParallelLexxer()
+{
+    Tokens lex;
+    lex << Token("ident", QRegExp("[a-z_][a-z_0-9]*"))
+        << Token("number", QRegExp("\\d+"))
+        << Token("string", QRegExp("\"[^\"]*\""))
+        << Token("comment", QRegExp("/\\*([^*]|\\*+[^*/])*\\*+/"))
+        << Token("plus", "+")
+        << Token("semicolon", ";");
+
+    // strings and comments spanning lines cross most chunk splits
+    QString text;
+    for (int i=0; text.size() < 400000; ++i)
+        text += QString("a%1 + %1; \"s\n%1\n\" /* c\n*%1\n */\n")
+                    .arg(i);
+
+    for (int mode = 0; mode < 2; ++mode)
+    {
+        lex.setMode(Tokens::Mode(mode));
+        lex.setNumThreads(1);
+        const QString expected = lexxed(lex, text);
+
+        for (int threads : { 1, 2, 3, 8 })
+        {
+            lex.setNumThreads(threads);
+            std::vector<LexxedToken> tokens;
+            QElapsedTimer timer;
+            timer.start();
+            lex.tokenize(text, tokens);
+            PRINT(text.size() << " chars with " << threads << " threads in "
+                  << timer.nsecsElapsed() / 1000 << "us");
+            QCOMPARE(lexxed(lex, text), expected);
+        }
+    }
+}
+
+void SyntakTestMath::testRelex()
+{
+    Tokens lex;
+    lex << Token("ident", QRegExp("[a-z_][a-z_0-9]*"))
+        << Token("number", QRegExp("\\d+"))
+        << Token("string", QRegExp("\"[^\"\\n]*\""))
+        << Token("comment", QRegExp("//[^\\n]*"))
+        << Token("equals", "=")
+        << Token("compare", "==")
+        << Token("semicolon", ";");
+
+    QString text;
+    for (int i=0; i<20; ++i)
+        text += QString("a%1 = %1; \"c\" // b\n").arg(i);
+    std::vector<LexxedToken> tokens;
+    lex.tokenize(text, tokens);
+
+    // random edits, tokens must equal a full tokenize
+    const QStringList snippets = QStringList()
+            << "" << " " << "x" << "1" << "=" << "\"" << "/" << "//"
+            << "\n" << "ab 2" << "=\"\n=";
+    quint32 rnd = 1;
+    auto random = [&rnd](int n)
+        { rnd = rnd * 1103515245 + 12345; return int((rnd >> 8) % n); };
+    for (int i=0; i<2000; ++i)
+    {
+        const int offset = random(text.size() + 1),
+                  removed = random(std::min(4, text.size() - offset + 1));
+        const QString inserted = snippets[random(snippets.size())];
+        text.replace(offset, removed, inserted);
+        lex.relex(text, tokens, TextEdit(offset, removed, inserted.size()));
+
+        std::vector<LexxedToken> expected;
+        lex.tokenize(text, expected);
+        QCOMPARE(lex.toString(text, tokens), lex.toString(text, expected));
+        for (size_t j=0; j<tokens.size(); ++j)
+            QCOMPARE(tokens[j].pos().line(), expected[j].pos().line());
+    }
+
+    // work depends on the edit, not the document
+    text.clear();
+    for (int i=0; i<10000; ++i)
+        text += QString("a%1 = %1;\n").arg(i);
+    tokens.clear();
+    lex.tokenize(text, tokens);
+    const int offset = text.indexOf("a5000 ");
+    text.replace(offset, 5, "b");
+    QCOMPARE(lex.relex(text, tokens, TextEdit(offset, 5, 1)), 2);
+    std::vector<LexxedToken> expected;
+    lex.tokenize(text, expected);
+    QCOMPARE(lex.toString(text, tokens), lex.toString(text, expected));
+
+    // parser
+    MathParser p;
+    QString program = "x = 1;\ny = x + 2;\nz = y * 3;";
+    p.parse(program);
+    QCOMPARE(p.variables["z"], 9);
+    program.replace(4, 1, "10");
+    p.parse(program, TextEdit(4, 1, 2));
+    QCOMPARE(p.variables["z"], 36);
+}
+
+void SyntakTestMath::testRuleIds()
+{
+    Tokens lex;
+    lex << Token("x", "x")
+        << Token("plus", "+")
+        << Token("bopen", "(")
+        << Token("bclose", ")");
+    Rules rules;
+    rules.addTokens(lex);
+    // the top rule only refers to itself, 'add' only from an operator
+    rules.createAnd("list", "sum", "[list]");
+    rules.createOperators("sum", "atom", QList<Operator>()
+        << Operator("plus", 1, Operator::O_LEFT, "add"));
+    rules.createOr( "atom", "paren", "x");
+    rules.createAnd("paren", "bopen", "sum", "bclose");
+    rules.check();
+    QVERIFY(rules.isValid());
+
+    QVERIFY(rules.topRule());
+    QCOMPARE(rules.topRule()->name(), QString("list"));
+    QVERIFY(rules.topRule()->isTop());
+    QVERIFY(!rules.find("add")->isTop());
+
+    // ID_EOF first, then the terminals, then the rules, each by name
+    QCOMPARE(int(Rules::ID_EOF), 0);
+    QVERIFY(!rules.rule(Rules::ID_EOF));
+    const QStringList names = QStringList()
+        << "bclose" << "bopen" << "plus" << "x"
+        << "add" << "atom" << "list" << "paren" << "sum";
+    QCOMPARE(rules.numIds(), names.size() + 1);
+    for (int id=1; id<rules.numIds(); ++id)
+    {
+        QCOMPARE(rules.rule(id)->name(), names[id-1]);
+        QCOMPARE(rules.rule(id)->id(), id);
+        QCOMPARE(rules.rule(id)->type() == Rule::T_TOKEN, id <= 4);
+    }
+
+    // a grammar where every rule is referenced has no top rule
+    Rules cyclic;
+    cyclic.addTokens(lex);
+    cyclic.createAnd("a", "x", "[b]");
+    cyclic.createAnd("b", "plus", "[a]");
+    cyclic.check();
+    QVERIFY(!cyclic.topRule());
+}
+
+void SyntakTestMath::testPackrat()
+{
+    // same results and callbacks as the backtracking engine
+    const QStringList programs = QStringList()
+            << "result= ((((((1+2)*3+4)*5+6)*7+8*9+10)*11+12)*13+14)*15;"
+            << "a = 1; b = a * (2 + -a); print(b); c = (a - b) / 2;";
+    for (const QString& program : programs)
+    {
+        MathParser p;
+        p.parse(program);
+        const auto variables = p.variables;
+        QStringList emits;
+        for (const auto& e : p.emits)
+            emits << e.toString();
+        const int visited = p.parser.numNodesVisited();
+
+        p.parser.setPackrat(true);
+        p.parse(program);
+        QCOMPARE(p.variables, variables);
+        QStringList packratEmits;
+        for (const auto& e : p.emits)
+            packratEmits << e.toString();
+        QCOMPARE(packratEmits, emits);
+        PRINT(visited << " nodes, packrat " << p.parser.numNodesVisited()
+              << " nodes " << p.parser.numMemoHits() << " memo hits");
+        QVERIFY(p.parser.numNodesVisited() <= visited);
+    }
+
+    // exponential backtracking:
+    // sum must parse every nested prim twice before it fails on '+'
+    Tokens lex;
+    lex << Token("plus", "+")
+        << Token("bopen", "(")
+        << Token("bclose", ")")
+        << Token("x", "x");
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program",  "sum");
+    rules.createOr( "sum",      "sum_plus", "prim");
+    rules.createAnd("sum_plus", "prim", "plus", "sum");
+    rules.createOr( "prim",     "paren", "x");
+    rules.createAnd("paren",    "bopen", "sum", "bclose");
+    Parser parser;
+    parser.setLexxer(lex);
+    parser.setRules(rules);
+
+    for (int depth = 4; depth <= 16; depth += 4)
+    {
+        const QString text = QString("(").repeated(depth) + "x"
+                           + QString(")").repeated(depth);
+        QElapsedTimer timer;
+        timer.start();
+        parser.setPackrat(false);
+        parser.parse(text);
+        const qint64 plainTime = timer.nsecsElapsed() / 1000;
+        const int plain = parser.numNodesVisited();
+
+        timer.start();
+        parser.setPackrat(true);
+        parser.parse(text);
+        const qint64 packratTime = timer.nsecsElapsed() / 1000;
+        const int packrat = parser.numNodesVisited();
+
+        PRINT("depth " << depth << ": " << plain << " nodes in "
+              << plainTime << "us, packrat " << packrat << " nodes in "
+              << packratTime << "us");
+        QVERIFY(packrat < 20 * depth);
+        QVERIFY(plain >= (1 << depth));
+    }
+}
+
+void SyntakTestMath::testFirstSets()
+{
+    MathParser p;
+    const Rules& rules = p.parser.rules();
+    auto rule = [&](const char* name) { return rules.rule(rules.id(name)); };
+    auto first = [&](const char* name)
+    {
+        QStringList s;
+        for (int id=1; id<rules.numIds(); ++id)
+            if (rule(name)->canStartWith(id))
+                s << rules.rule(id)->name();
+        s.sort();
+        return s.join(" ");
+    };
+
+    QCOMPARE(first("op1_term"), QString("minus plus"));
+    QCOMPARE(first("int_expr"), QString("bopen digit letter minus plus"));
+    QCOMPARE(first("statement"), QString("letter print"));
+    QVERIFY(!rule("int_expr")->isNullable());
+
+    const Rule* uintExpr = rule("uint_expr");
+    QCOMPARE(uintExpr->alternatives(rules.id("digit")), std::vector<int>{ 0 });
+    QCOMPARE(uintExpr->alternatives(rules.id("letter")), std::vector<int>{ 1 });
+    QCOMPARE(uintExpr->alternatives(rules.id("bopen")), std::vector<int>{ 2 });
+    QVERIFY(uintExpr->alternatives(rules.id("mul")).empty());
+
+    // optional subrules pass FIRST on, nullable alternatives always fit
+    Tokens lex;
+    lex << Token("a", "a") << Token("b", "b") << Token("c", "c");
+    Rules r2;
+    r2.addTokens(lex);
+    r2.createAnd("top",    "maybe", "c");
+    r2.createOr( "maybe",  "as", "b");
+    r2.createAnd("as",     "[a]*");
+    r2.check();
+    const Rule* top = r2.rule(r2.id("top"));
+    QVERIFY(r2.rule(r2.id("as"))->isNullable());
+    QVERIFY(r2.rule(r2.id("maybe"))->isNullable());
+    QVERIFY(!top->isNullable());
+    QVERIFY(top->canStartWith(r2.id("a")));
+    QVERIFY(top->canStartWith(r2.id("b")));
+    QVERIFY(top->canStartWith(r2.id("c")));
+    QCOMPARE(r2.rule(r2.id("maybe"))->alternatives(r2.id("b")),
+             (std::vector<int>{ 0, 1 }));
+    QCOMPARE(r2.rule(r2.id("maybe"))->alternatives(r2.id("c")),
+             std::vector<int>{ 0 });
+}
+
+void SyntakTestMath::testParseTable()
+{
+    MathParser p;
+    QVERIFY(p.parser.parseTable().isLL1());
+    if (!p.parser.parseTable().isLL1())
+        PRINT(p.parser.parseTable().conflicts().join("\n"));
+
+    // same callbacks in the same order
+    const QStringList programs = QStringList()
+            << "result= ((((((1+2)*3+4)*5+6)*7+8*9+10)*11+12)*13+14)*15;"
+            << "a = 1; b2 = a * (2 + -a); print(b2); c = (a - b2) / 2;"
+            << "x = -(-(1));";
+    for (const QString& program : programs)
+    {
+        p.parser.setEngine(Parser::E_BACKTRACKING);
+        p.parse(program);
+        const auto variables = p.variables;
+        QStringList emits;
+        for (const auto& e : p.emits)
+            emits << e.toString();
+        const int visited = p.parser.numNodesVisited();
+
+        p.parser.setEngine(Parser::E_TABLE);
+        p.parse(program);
+        QCOMPARE(p.parser.usedEngine(), Parser::E_TABLE);
+        QCOMPARE(p.variables, variables);
+        QStringList tableEmits;
+        for (const auto& e : p.emits)
+            tableEmits << e.toString();
+        QCOMPARE(tableEmits, emits);
+        PRINT(visited << " nodes, table " << p.parser.numNodesVisited());
+    }
+
+    // no recursion, nesting is not limited
+    const int depth = 5000;
+    p.parse("x = " + QString("(").repeated(depth) + "1"
+            + QString(")").repeated(depth) + ";");
+    QCOMPARE(p.variables["x"], 1);
+
+    // conflicts are reported, parsing falls back to backtracking
+    Tokens lex;
+    lex << Token("plus", "+")
+        << Token("bopen", "(")
+        << Token("bclose", ")")
+        << Token("x", "x");
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program",  "sum", "[plus]");
+    rules.createOr( "sum",      "sum_plus", "prim");
+    rules.createAnd("sum_plus", "prim", "plus", "sum");
+    rules.createOr( "prim",     "paren", "x");
+    rules.createAnd("paren",    "bopen", "sum", "bclose");
+    Parser parser;
+    parser.setLexxer(lex);
+    parser.setRules(rules);
+    parser.setEngine(Parser::E_TABLE);
+    PRINT(parser.parseTable().conflicts().join("\n"));
+    QCOMPARE(parser.parseTable().conflicts(), QStringList()
+             << "sum: alternatives sum_plus and prim both fit bopen, x");
+    parser.parse("(x+x)+x");
+    QCOMPARE(parser.usedEngine(), Parser::E_BACKTRACKING);
+
+    Rules greedy;
+    greedy.addTokens(lex);
+    greedy.createAnd("program", "[x]*", "x", "plus");
+    parser.setRules(greedy);
+    QCOMPARE(parser.parseTable().conflicts(), QStringList()
+             << "program: [x]* and what follows both start with x");
+}
+
+void SyntakTestMath::testDeepNesting()
+{
+    // far beyond what native recursion would allow
+    const int depth = 5000;
+    const QString program = "x = " + QString("(").repeated(depth) + "1"
+            + QString(")").repeated(depth) + " + 2;";
+
+    MathParser p;
+    for (bool packrat : { false, true })
+    {
+        p.parser.setPackrat(packrat);
+        QElapsedTimer timer;
+        timer.start();
+        p.parse(program);
+        PRINT("depth " << depth << ": " << p.parser.numNodesVisited()
+              << " nodes in " << timer.nsecsElapsed() / 1000 << "us");
+        QCOMPARE(p.variables["x"], 3);
+    }
+}
+
+void SyntakTestMath::testOperators()
+{
+    // same callbacks as the cascade of precedence levels
+    const QStringList programs = QStringList()
+            << "result= ((((((1+2)*3+4)*5+6)*7+8*9+10)*11+12)*13+14)*15;"
+            << "a = 1; b2 = a * (2 + -a); print(b2); c = (a - b2) / 2;"
+            << "x = 1 - 2 - 3 * 4 / 2 + 5;";
+    MathParser cascade, ops(true);
+    QVERIFY(ops.parser.parseTable().isLL1());
+    for (const QString& program : programs)
+    {
+        cascade.parse(program);
+        QStringList emits;
+        for (const auto& e : cascade.emits)
+            emits << e.toString();
+
+        for (auto engine : { Parser::E_BACKTRACKING, Parser::E_TABLE })
+        for (bool packrat : { false, true })
+        {
+            ops.parser.setEngine(engine);
+            ops.parser.setPackrat(packrat);
+            ops.parse(program);
+            QCOMPARE(ops.variables, cascade.variables);
+            QStringList opsEmits;
+            for (const auto& e : ops.emits)
+                opsEmits << e.toString();
+            QCOMPARE(opsEmits, emits);
+        }
+        PRINT(cascade.parser.numNodesVisited() << " nodes, operators "
+              << ops.parser.numNodesVisited());
+        QVERIFY(ops.parser.numNodesVisited()
+                < cascade.parser.numNodesVisited());
+    }
+
+    // right associativity and prefix operators
+    Tokens lex;
+    lex << Token("pow", "^")
+        << Token("minus", "-")
+        << Token("plus", "+")
+        << Token("x", QRegExp("[a-z]"));
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program", "expr");
+    rules.createOperators("expr", "x", QList<Operator>()
+        << Operator("plus",  1, Operator::O_LEFT,   "add")
+        << Operator("minus", 1, Operator::O_LEFT,   "add")
+        << Operator("minus", 2, Operator::O_PREFIX, "neg")
+        << Operator("pow",   3, Operator::O_RIGHT,  "pow_x"));
+    QStringList applied;
+    for (const char* name : { "add", "neg", "pow_x" })
+        rules.connect(name, [&](const ParsedToken& t)
+        {
+            applied << t.text();
+        });
+    Parser parser;
+    parser.setLexxer(lex);
+    parser.setRules(rules);
+    QVERIFY(parser.parseTable().isLL1());
+    for (auto engine : { Parser::E_BACKTRACKING, Parser::E_TABLE })
+    {
+        parser.setEngine(engine);
+        applied.clear();
+        parser.parse("a^b^c-d");
+        QCOMPARE(applied, QStringList() << "^c" << "^b^c" << "-d");
+        applied.clear();
+        parser.parse("-a^b+c");
+        QCOMPARE(applied, QStringList() << "^b" << "-a^b" << "+c");
+    }
+}
+
+void SyntakTestMath::testSyntaxTree()
+{
+    Tokens lex;
+    lex << Token("plus", "+")
+        << Token("bopen", "(")
+        << Token("bclose", ")")
+        << Token("x", "x");
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program",  "sum");
+    rules.createOr( "sum",      "sum_plus", "prim");
+    rules.createAnd("sum_plus", "prim", "plus", "sum");
+    rules.createOr( "prim",     "paren", "x");
+    rules.createAnd("paren",    "bopen", "sum", "bclose");
+    Parser parser;
+    parser.setLexxer(lex);
+    parser.setRules(rules);
+    parser.setBuildTree(true);
+
+    // failed alternatives leave no nodes
+    const QString expected = "program(sum(sum_plus(prim(paren(bopen "
+            "sum(sum_plus(prim(x) plus sum(prim(x)))) bclose)) plus "
+            "sum(prim(x)))))";
+    for (bool packrat : { false, true })
+    {
+        parser.setPackrat(packrat);
+        parser.parse("(x+x)+x");
+        const SyntaxTree& tree = parser.syntaxTree();
+        QCOMPARE(tree.toString(parser.rules()), expected);
+        QCOMPARE(parser.nodeText(tree.root()), QString("(x+x)+x"));
+        QCOMPARE(tree.node(tree.root()).begin, 0);
+        QCOMPARE(tree.node(tree.root()).end, 7);
+        if (!packrat)
+            QCOMPARE(tree.size(), 19);
+    }
+
+    // both engines, operator rules and memory reuse
+    const QString program =
+            "a = 1; b2 = a * (2 + -a); print(b2); c = (a - b2) / 2;";
+    for (bool operators : { false, true })
+    {
+        MathParser p(operators);
+        p.parser.setBuildTree(true);
+        p.parse(program);
+        const SyntaxTree& tree = p.parser.syntaxTree();
+        const QString backtracking = tree.toString(p.parser.rules());
+        QCOMPARE(p.parser.nodeText(tree.root()), program);
+        QCOMPARE(tree.numChildren(tree.root()), 4);
+        PRINT(tree.size() << " nodes");
+
+        p.parser.setEngine(Parser::E_TABLE);
+        p.parse(program);
+        QCOMPARE(p.parser.usedEngine(), Parser::E_TABLE);
+        QCOMPARE(tree.toString(p.parser.rules()), backtracking);
+
+        p.parser.setEngine(Parser::E_BACKTRACKING);
+        p.parser.setPackrat(true);
+        p.parse(program);
+        QCOMPARE(tree.toString(p.parser.rules()), backtracking);
+
+        // a subtree of every statement
+        for (int s = tree.node(tree.root()).firstChild; s >= 0;
+             s = tree.node(s).nextSibling)
+            QVERIFY(p.parser.nodeText(s).endsWith(";"));
+    }
+}
+
+void SyntakTestMath::testDeferCallbacks()
+{
+    Tokens lex;
+    lex << Token("plus", "+")
+        << Token("bopen", "(")
+        << Token("bclose", ")")
+        << Token("x", "x");
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program",  "sum");
+    rules.createOr( "sum",      "sum_plus", "prim");
+    rules.createAnd("sum_plus", "prim", "plus", "sum");
+    rules.createOr( "prim",     "paren", "x");
+    rules.createAnd("paren",    "bopen", "sum", "bclose");
+    QStringList prims;
+    rules.connect("prim", [&](const ParsedToken& t) { prims << t.text(); });
+    Parser parser;
+    parser.setLexxer(lex);
+    parser.setRules(rules);
+
+    // sum_plus parses the last prim of every sum before it fails
+    parser.parse("(x+x)+x");
+    PRINT("immediate: " << prims.join(" "));
+    QCOMPARE(prims.size(), 6);
+    QCOMPARE(parser.numCallbacksDiscarded(), 0);
+
+    parser.setDeferCallbacks(true);
+    for (bool packrat : { false, true })
+    {
+        parser.setPackrat(packrat);
+        prims.clear();
+        parser.parse("(x+x)+x");
+        QCOMPARE(prims, QStringList() << "x" << "x" << "(x+x)" << "x");
+        PRINT("deferred, packrat " << packrat << ": "
+              << parser.numCallbacksDiscarded() << " discarded");
+        QVERIFY(parser.numCallbacksDiscarded() > 0);
+    }
+
+    // same results where nothing is discarded
+    const QString program =
+            "a = 1; b2 = a * (2 + -a); print(b2); c = (a - b2) / 2;";
+    MathParser p;
+    p.parse(program);
+    const auto variables = p.variables;
+    const int numEmits = p.emits.size();
+    p.parser.setDeferCallbacks(true);
+    p.parse(program);
+    QCOMPARE(p.variables, variables);
+    QCOMPARE(p.emits.size(), numEmits);
+}
+
+void SyntakTestMath::testNoAllocations()
+{
+    Tokens lex;
+    lex << Token("plus", "+")
+        << Token("mul", "*")
+        << Token("bopen", "(")
+        << Token("bclose", ")")
+        << Token("semicolon", ";")
+        << Token("equals", "=")
+        << Token("num", QRegExp("[0-9]+"))
+        << Token("ident", QRegExp("[a-z]+"));
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program",   "statement", "[statement]*");
+    rules.createAnd("statement", "ident", "equals", "expr", "semicolon");
+    rules.createOperators("expr", "prim", QList<Operator>()
+        << Operator("plus", 1, Operator::O_LEFT, "add")
+        << Operator("mul",  2, Operator::O_LEFT, "mul_prim"));
+    rules.createOr( "prim",      "num", "ident", "paren");
+    rules.createAnd("paren",     "bopen", "expr", "bclose");
+    int numChars = 0, numCalls = 0;
+    for (const char* name : { "statement", "add", "prim" })
+        rules.connect(name, [&](const ParsedToken& t)
+        {
+            numChars += t.textRef().size();
+            ++numCalls;
+        });
+
+    QString program;
+    for (int i=0; i<100; ++i)
+        program += QString("x%1 = (a + %1) * b + c * (%1 + 1);\n")
+                   .arg(QChar('a' + i % 26));
+
+    Parser parser;
+    parser.setLexxer(lex, Tokens::M_COMPILED);
+    parser.setRules(rules);
+    for (int config = 0; config < 4; ++config)
+    {
+        parser.setEngine(config == 1 ? Parser::E_TABLE
+                                     : Parser::E_BACKTRACKING);
+        parser.setDeferCallbacks(config == 2);
+        parser.setBuildTree(config == 3);
+        // warm up
+        numCalls = 0;
+        parser.parse(program);
+        const int calls = numCalls;
+
+        p_numAllocs = 0;
+        p_countAllocs = true;
+        parser.parse(program);
+        p_countAllocs = false;
+
+        PRINT("config " << config << ": " << p_numAllocs
+              << " allocations, " << numCalls - calls << " callbacks");
+        QCOMPARE(p_numAllocs, 0);
+        QCOMPARE(numCalls, 2 * calls);
+    }
+    QVERIFY(numChars > 0);
+
+    // kept tokens outlive the next, shorter parse and the Parser
+    QList<ParsedToken> kept;
+    {
+        Parser shortLived;
+        shortLived.setLexxer(lex);
+        shortLived.setRules(rules);
+        shortLived.parse(program);
+        rules.connect("statement", [&](const ParsedToken& t)
+            { kept << t; });
+        shortLived.setRules(rules);
+        shortLived.parse("long = 1 + 2;");
+        shortLived.parse("x = 1;");
+    }
+    QCOMPARE(kept.size(), 2);
+    QCOMPARE(kept[0].text(), QString("long = 1 + 2;"));
+    QCOMPARE(kept[0].textRef().toString(), QString("long = 1 + 2;"));
+    QCOMPARE(kept[1].text(), QString("x = 1;"));
+}
+
+void SyntakTestMath::testSharedGrammar()
+{
+    auto grammar = MathParser::createGrammar(false);
+    QVERIFY(grammar->isThreadSafe());
+
+    QStringList programs;
+    for (int i=0; i<200; ++i)
+        programs << QString("a = %1; b = a * (a + %2) - 3; c = b / (a + 1);")
+                    .arg(i).arg(i % 7);
+    std::vector<QMap<QString, int>> expected;
+    for (const QString& program : programs)
+    {
+        MathParser p(grammar);
+        p.parse(program);
+        expected.push_back(p.variables);
+    }
+
+    // one MathParser per thread, all on the same grammar
+    const int numThreads = 4;
+    std::vector<QMap<QString, int>> results(programs.size());
+    std::vector<std::thread> threads;
+    for (int t=0; t<numThreads; ++t)
+        threads.push_back(std::thread([&, t]()
+        {
+            MathParser p(grammar);
+            for (int i=t; i<programs.size(); i+=numThreads)
+            {
+                p.parse(programs[i]);
+                results[i] = p.variables;
+            }
+        }));
+    for (auto& t : threads)
+        t.join();
+    QVERIFY(results == expected);
+
+    // the same from UTF-8, lexxed with the TokenDfa of the shared
+    // M_PROBE lexxer, which must not be built on first use
+    std::vector<QByteArray> utf8;
+    for (const QString& program : programs)
+        utf8.push_back(program.toUtf8());
+    results.assign(programs.size(), QMap<QString, int>());
+    threads.clear();
+    for (int t=0; t<numThreads; ++t)
+        threads.push_back(std::thread([&, t]()
+        {
+            MathParser p(grammar);
+            for (int i=t; i<programs.size(); i+=numThreads)
+            {
+                p.parse(Utf8Input(utf8[i]));
+                results[i] = p.variables;
+            }
+        }));
+    for (auto& t : threads)
+        t.join();
+    QVERIFY(results == expected);
+
+    // callbacks of a Parser replace the ones of the grammar,
+    // the grammar keeps its own copy of the rules
+    Tokens lex;
+    lex << Token("x", "x");
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program", "x", "[x]*");
+    int shared = 0, own = 0;
+    rules.connect("x", [&](const ParsedToken&) { ++shared; });
+    auto xs = CompiledGrammar::create(lex, rules);
+    rules.connect("x", [&](const ParsedToken&) { shared += 100; });
+    Parser p1(xs), p2(xs);
+    p2.connect("x", [&](const ParsedToken&) { ++own; });
+    p1.parse("xxx");
+    p2.parse("xx");
+    QCOMPARE(shared, 3);
+    QCOMPARE(own, 2);
+    QCOMPARE(p1.rules().rule(p1.rules().id("x")),
+             p2.rules().rule(p2.rules().id("x")));
+}
+
+void SyntakTestMath::testParseMany()
+{
+    Tokens lex;
+    lex << Token("plus", "+")
+        << Token("mul", "*")
+        << Token("bopen", "(")
+        << Token("bclose", ")")
+        << Token("semicolon", ";")
+        << Token("num", QRegExp("[0-9]+"));
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program",   "expr", "semicolon");
+    rules.createOperators("expr", "prim", QList<Operator>()
+        << Operator("plus", 1, Operator::O_LEFT, "add")
+        << Operator("mul",  2, Operator::O_LEFT, "mul_prim"));
+    rules.createOr( "prim",      "num", "paren");
+    rules.createAnd("paren",     "bopen", "expr", "bclose");
+    auto grammar = CompiledGrammar::create(lex, rules);
+
+    QStringList inputs;
+    std::vector<qint64> expected;
+    for (int i=0; i<20000; ++i)
+    {
+        inputs << QString("%1 + %2 * (%3 + 1) * 2;")
+                  .arg(i).arg(i % 13).arg(i % 7);
+        expected.push_back(i + (i % 13) * (i % 7 + 1) * 2);
+    }
+
+    // evaluation stack per worker
+    const int ideal = QThread::idealThreadCount();
+    std::vector<std::vector<qint64>> stacks(std::max(4, ideal));
+    ParsePool pool(grammar);
+    pool.setInit([&](Parser& parser, int worker)
+    {
+        // the workers do not start lexxer threads of their own
+        QCOMPARE(parser.lexxerThreads(), 1);
+        auto& stack = stacks[worker];
+        parser.connect("num", [&](const ParsedToken& t)
+        {
+            stack.push_back(t.textRef().toInt());
+        });
+        auto binary = [&](bool mul)
+        {
+            const qint64 b = stack.back();
+            stack.pop_back();
+            stack.back() = mul ? stack.back() * b : stack.back() + b;
+        };
+        parser.connect("add", [=](const ParsedToken&) { binary(false); });
+        parser.connect("mul_prim", [=](const ParsedToken&) { binary(true); });
+    });
+    auto result = [&](Parser&, int worker)
+    {
+        const qint64 v = stacks[worker].back();
+        stacks[worker].clear();
+        return v;
+    };
+
+    double single = 0.;
+    for (int threads : { 1, 2, 4, ideal })
+    {
+        pool.setNumThreads(threads);
+        // warm up the workers' Parsers
+        pool.parseMany<qint64>(inputs, result);
+        const auto values = pool.parseMany<qint64>(inputs, result);
+        QVERIFY(values == expected);
+        QCOMPARE(pool.numDocuments(), inputs.size());
+
+        int sum = 0;
+        for (int n : pool.documentsPerWorker())
+            sum += n;
+        QCOMPARE(sum, inputs.size());
+
+        if (single == 0.)
+            single = pool.documentsPerSecond();
+        PRINT(threads << " threads: "
+              << int(pool.documentsPerSecond()) << " docs/s, "
+              << int(pool.numChars() * 1e3 / pool.nsecsElapsed())
+              << " MChars/s, speedup "
+              << pool.documentsPerSecond() / single
+              << " (" << ideal << " cores)");
+    }
+}
+
+void SyntakTestMath::testErrorRecovery()
+{
+    // failing statements are skipped up to their semicolon
+    const QString program = "a = 1; b = a +; c = 2 * (a; d = a + 2;";
+    MathParser p;
+    p.parser.setDeferCallbacks(true);
+    for (bool packrat : { false, true })
+    {
+        p.parser.setPackrat(packrat);
+        const ParseResult& r = p.parse(program);
+        PRINT(r.toString());
+        QVERIFY(r.isMatched());
+        QVERIFY(!r.isOk());
+        QCOMPARE(int(r.diagnostics().size()), 2);
+        QCOMPARE(r.diagnostics()[0].pos().pos(), program.indexOf("+;") + 1);
+        QCOMPARE(r.diagnostics()[1].pos().pos(), program.indexOf("a;") + 1);
+        QCOMPARE(r.diagnostics()[0].message(),
+                 QString("Unexpected semicolon in s_statement"));
+        QCOMPARE(p.variables.size(), 2);
+        QCOMPARE(p.variables["a"], 1);
+        QCOMPARE(p.variables["d"], 3);
+    }
+    QVERIFY(p.parse("a = 1; d = a + 2;").isOk());
+
+    // tokens that can not start a statement
+    const ParseResult& r = p.parse("a = 1; ) ) b = 2; c = 3;");
+    QVERIFY(r.isMatched());
+    QCOMPARE(int(r.diagnostics().size()), 1);
+    QCOMPARE(r.diagnostics()[0].skipEnd() - r.diagnostics()[0].skipBegin(), 6);
+    QCOMPARE(p.variables.size(), 2);
+    QCOMPARE(p.variables["c"], 3);
+
+    // without sync tokens and with the table engine the parse stops
+    MathParser table(true);
+    table.parser.setEngine(Parser::E_TABLE);
+    QVERIFY(!table.parse("a = 1; b = a +; c = 2;").isMatched());
+    QCOMPARE(int(table.parser.result().diagnostics().size()), 1);
+    QCOMPARE(table.parser.result().diagnostics()[0].pos().pos(), 14);
+
+    Tokens lex;
+    lex << Token("x", "x") << Token("y", "y");
+    Rules rules;
+    rules.addTokens(lex);
+    rules.createAnd("program", "x", "[x]*");
+    Parser parser;
+    parser.setLexxer(lex);
+    parser.setRules(rules);
+    QVERIFY(parser.parse("xxx").isOk());
+    QVERIFY(parser.parse("xxy").isMatched());
+    QCOMPARE(parser.result().diagnostics()[0].message(),
+             QString("Unexpected y"));
+    QVERIFY(!parser.parse("yx").isMatched());
+    QCOMPARE(parser.result().diagnostics()[0].message(),
+             QString("Unexpected y in program"));
+
+    // grammar errors do not abort either
+    rules.createAnd("programs", "program", "[z]*");
+    parser.setRules(rules);
+    QCOMPARE(parser.rules().errors().size(), 1);
+    QVERIFY(!parser.parse("xx").isMatched());
+    QCOMPARE(parser.result().diagnostics()[0].message(),
+             QString("Subrule z in programs not known"));
+    QVERIFY(!parser.connect("z", [](const ParsedToken&) { }));
+}
+
+void SyntakTestMath::testIncremental()
+{
+    QString program;
+    for (int i=0; i<2000; ++i)
+        program += QString("v%1 = %2 * (v%3 + %4);\n")
+                   .arg(i).arg(i % 10).arg(i / 2).arg(i % 7);
+
+    // rule names and token ranges of the linked nodes
+    std::function<QString(const Parser&, int)> dump =
+            [&](const Parser& p, int i)
+    {
+        const SyntaxTree::Node& n = p.syntaxTree().node(i);
+        QString s = QString("%1[%2,%3](").arg(p.rules().rule(n.rule)->name())
+                    .arg(n.begin).arg(n.end);
+        for (int c = n.firstChild; c != SyntaxTree::NO_NODE;
+             c = p.syntaxTree().node(c).nextSibling)
+            s += dump(p, c);
+        return s + ")";
+    };
+    auto emits = [](const MathParser& p)
+    {
+        QStringList e;
+        for (const ParsedToken& t : p.emits)
+            e << t.toString();
+        return e;
+    };
+
+    MathParser inc, fresh;
+    inc.parser.setIncremental(true);
+    inc.parser.setBuildTree(true);
+    fresh.parser.setBuildTree(true);
+    inc.parse(program);
+    const int full = inc.parser.numNodesVisited();
+
+    struct Edit { QString at; int skip, removed; QString inserted; };
+    const QList<Edit> edits = QList<Edit>()
+            // a digit in the middle
+            << Edit{ "v1000 =", 8, 1, "7" }
+            // a statement with a line break
+            << Edit{ "v1500 =", 0, 0, "w = 5;\nx = w;\n" }
+            // inside the statement reused after the first edit
+            << Edit{ "v1000 =", 0, 2, "u" }
+            << Edit{ "v0 =", 0, 0, "a = 1;" }
+            << Edit{ "v1999 =", 24, 0, "a = 2;" };
+    for (const Edit& e : edits)
+    {
+        const int offset = program.indexOf(e.at) + e.skip;
+        program.replace(offset, e.removed, e.inserted);
+        QVERIFY(inc.parse(program, TextEdit(offset, e.removed,
+                                            e.inserted.size())).isOk());
+        QVERIFY(fresh.parse(program).isOk());
+
+        const int parsed = inc.parser.numNodesVisited()
+                         - inc.parser.numMemoHits();
+        PRINT("edit at " << offset << ": " << parsed << " nodes parsed, "
+              << inc.parser.numReused() << " results reused, full parse "
+              << full << " nodes");
+        QVERIFY(parsed < 200);
+        QCOMPARE(inc.variables, fresh.variables);
+        QCOMPARE(emits(inc), emits(fresh));
+        QCOMPARE(dump(inc.parser, 0), dump(fresh.parser, 0));
+    }
+
+    // the rest of the reparse is one lookup per reused statement,
+    // not one per rule
+    const int statements = program.count(';');
+    const int offset = program.indexOf("v1000 =") + 5;
+    qint64 edited = -1, parsed = -1;
+    for (int run = 0; run < 4; ++run)
+    {
+        program[offset] = run % 2 ? '2' : '3';
+        QElapsedTimer timer;
+        timer.start();
+        QVERIFY(inc.parse(program, TextEdit(offset, 1, 1)).isOk());
+        const qint64 ns = timer.nsecsElapsed();
+        if (edited < 0 || ns < edited)
+            edited = ns;
+        QVERIFY(inc.parser.numReused() <= statements);
+        QVERIFY(inc.parser.numMemoHits() - inc.parser.numReused() < 20);
+
+        timer.start();
+        QVERIFY(fresh.parse(program).isOk());
+        const qint64 full = timer.nsecsElapsed();
+        if (parsed < 0 || full < parsed)
+            parsed = full;
+    }
+    PRINT(statements << " statements: edit reparsed in " << edited / 1000
+          << "us, full parse " << parsed / 1000 << "us");
+}
+
+void SyntakTestMath::testGrammarData()
+{
+    const QString program =
+            "a = 1; b2 = a * (2 + -a); print(b2); c = (a - b2) / 2;";
+    for (bool operators : { false, true })
+    {
+        QElapsedTimer timer;
+        timer.start();
+        auto grammar = MathParser::createGrammar(operators);
+        const qint64 built = timer.nsecsElapsed();
+        // with the tables of the compiled lexxer as well
+        Tokens lex(grammar->lexxer());
+        lex.setMode(Tokens::M_COMPILED);
+        grammar = CompiledGrammar::create(lex, grammar->rules());
+
+        const QByteArray data = grammar->toData();
+        timer.restart();
+        auto loaded = CompiledGrammar::fromData(data);
+        const qint64 read = timer.nsecsElapsed();
+        PRINT("operators " << operators << ": " << data.size()
+              << " bytes, built in " << built / 1000 << "us, read in "
+              << read / 1000 << "us");
+
+        QVERIFY(loaded);
+        QVERIFY(loaded->isThreadSafe());
+        QVERIFY(loaded->toData() == data);
+        QCOMPARE(loaded->rules().toDefinitionString(),
+                 grammar->rules().toDefinitionString());
+        QCOMPARE(loaded->parseTable().conflicts(),
+                 grammar->parseTable().conflicts());
+
+        // callbacks are connected by name
+        MathParser a(grammar), b(loaded);
+        for (auto engine : { Parser::E_BACKTRACKING, Parser::E_TABLE })
+        {
+            a.parser.setEngine(engine);
+            b.parser.setEngine(engine);
+            QVERIFY(a.parse(program).isOk());
+            QVERIFY(b.parse(program).isOk());
+            QCOMPARE(b.parser.usedEngine(), a.parser.usedEngine());
+            QCOMPARE(b.variables, a.variables);
+            QCOMPARE(b.emits.size(), a.emits.size());
+            for (int i=0; i<a.emits.size(); ++i)
+                QCOMPARE(b.emits[i].toString(), a.emits[i].toString());
+        }
+    }
+
+    auto grammar = MathParser::createGrammar(false);
+    const QByteArray data = grammar->toData();
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    file.write(data);
+    file.flush();
+    QString error;
+    auto loaded = CompiledGrammar::load(file.fileName(), &error);
+    QVERIFY(loaded);
+    MathParser p(loaded);
+    p.parse("x = 6 * 7;");
+    QCOMPARE(p.variables["x"], 42);
+
+    QVERIFY(!CompiledGrammar::fromData("junk", &error));
+    QCOMPARE(error, QString("not a grammar"));
+    QByteArray other = data;
+    other.data()[7] = 99;
+    QVERIFY(!CompiledGrammar::fromData(other, &error));
+    QCOMPARE(error, QString("grammar version 99, expected 1"));
+    for (int size : { 8, 100, data.size() / 2, data.size() - 1 })
+    {
+        QVERIFY(!CompiledGrammar::fromData(data.mid(0, size), &error));
+        QCOMPARE(error, QString("corrupt grammar data"));
+    }
+}
+
+void SyntakTestMath::testStaticGrammar()
+{
+    const QString program = MathParser::createProgram(2000);
+
+    auto grammar = MathParser::createGrammar(false);
+    MathParser runtime(grammar);
+    StaticMathParser typed(grammar);
+    // the same callbacks, connected by name
+    StaticGrammar::Parser<StaticMath::program> connected(grammar);
+    MathParser byName(grammar);
+    byName.connect(connected.actions());
+
+    auto compare = [&](const MathParser& m)
+    {
+        QCOMPARE(m.variables, runtime.variables);
+        QCOMPARE(m.emits.size(), runtime.emits.size());
+        for (int i=0; i<m.emits.size(); ++i)
+            QCOMPARE(m.emits[i].toString(), runtime.emits[i].toString());
+    };
+
+    // timed against each other in tests/bench_grammar
+    QVERIFY(runtime.parse(program).isOk());
+    byName.clear();
+    QVERIFY(connected.parse(program));
+    compare(byName);
+    QVERIFY(typed.parse(program));
+    compare(typed.math);
+
+    QVERIFY(!typed.parse("a = 1; b = ;"));
+    QVERIFY(!typed.parse("a = 1"));
+    QVERIFY(typed.parse("a = 6 * (3 + 4); print(a);"));
+    QCOMPARE(typed.math.variables["a"], 42);
+
+    // token kinds are looked up by name, the order does not matter
+    Tokens reversed;
+    for (auto t = grammar->lexxer().tokens().rbegin();
+         t != grammar->lexxer().tokens().rend(); ++t)
+        reversed << *t;
+    auto reordered = CompiledGrammar::create(reversed, grammar->rules());
+    StaticGrammar::Parser<StaticMath::program> shuffled(reordered);
+    MathParser byShuffled(reordered);
+    byShuffled.connect(shuffled.actions());
+    QVERIFY(shuffled.errors().isEmpty());
+    QVERIFY(shuffled.parse(program));
+    compare(byShuffled);
+
+    Tokens missing;
+    missing << Token("letter", QRegExp("[a-z]"))
+            << Token("equals", "=")
+            << Token("digit", QRegExp("[0-9]"));
+    StaticGrammar::Parser<StaticMath::program> broken(missing);
+    QCOMPARE(broken.errors().size(), 8);
+    QVERIFY(broken.errors().contains("token 'semicolon' not in the lexxer"));
+    QVERIFY(!broken.parse("a = 1;"));
+}
+
+namespace {
+
+    /** Parses @p program with a parser generated by syntak-gen
+        and compares the callbacks with the runtime engine */
+    template <class GeneratedParser>
+    void compareGenerated(const QString& program, bool operators)
+    {
+        auto grammar = MathParser::createGrammar(operators);
+        MathParser runtime(grammar), math(grammar);
+        GeneratedParser generated(grammar->lexxer(), &grammar->rules());
+        math.connect(generated);
+
+        QVERIFY(runtime.parse(program).isOk());
+        QVERIFY(generated.parse(program));
+        QCOMPARE(math.variables, runtime.variables);
+        QCOMPARE(math.emits.size(), runtime.emits.size());
+        for (int i=0; i<math.emits.size(); ++i)
+            QCOMPARE(math.emits[i].toString(), runtime.emits[i].toString());
+
+        QVERIFY(!generated.parse("a = 1; b = ;"));
+        QVERIFY(!generated.parse("a = 1"));
+        math.clear();
+        QVERIFY(generated.parse("a = -6 * (3 + 4); print(a);"));
+        QCOMPARE(math.variables["a"], -42);
+    }
+
+} // namespace
+
+void SyntakTestMath::testGeneratedParser()
+{
+    // the notation reads back into the same rules
+    for (bool operators : { false, true })
+    {
+        const Rules& rules = MathParser::createGrammar(operators)->rules();
+        QString error;
+        const Rules read = Rules::fromDefinitionString(
+                    rules.toDefinitionString(), &error);
+        QVERIFY(error.isEmpty());
+        QCOMPARE(read.toDefinitionString(), rules.toDefinitionString());
+    }
+    QString error;
+    QVERIFY(Rules::fromDefinitionString("# two rules\na : b\nc = d", &error)
+            .toDefinitionString().isEmpty());
+    QCOMPARE(error, QString("line 3: expected 'name : definition'"));
+    ParserGenerator gen(Rules::fromDefinitionString("a : b c"));
+    QVERIFY(gen.generate().isEmpty());
+    QCOMPARE(gen.errors().size(), 2);
+
+    const QString program = MathParser::createProgram(2000);
+    // generated from calc.syn and calc_ops.syn
+    compareGenerated<CalcParser>(program, false);
+    compareGenerated<CalcOpsParser>(program, true);
+}
 
 QTEST_APPLESS_MAIN(SyntakTestMath)
 
@@ -17,13 +17,40 @@ INCLUDEPATH += ../../syntak
 
 SOURCES += \
     ../../syntak/Tokens.cpp \
+    ../../syntak/TokenDfa.cpp \
+    ../../syntak/Scanner.cpp \
+    ../../syntak/TokenStream.cpp \
+    ../../syntak/Utf8Input.cpp \
     ../../syntak/Rules.cpp \
+    ../../syntak/ParseTable.cpp \
+    ../../syntak/CompiledGrammar.cpp \
+    ../../syntak/SyntaxTree.cpp \
     ../../syntak/Parser.cpp \
+    ../../syntak/ParsePool.cpp \
+    ../../syntak/ParserGenerator.cpp \
     main.cpp 
 
 HEADERS += \
     ../../syntak/Tokens.h \
+    ../../syntak/TokenDfa.h \
+    ../../syntak/Scanner.h \
+    ../../syntak/TokenStream.h \
+    ../../syntak/Utf8Input.h \
     ../../syntak/Rules.h \
+    ../../syntak/ParseTable.h \
+    ../../syntak/CompiledGrammar.h \
+    ../../syntak/GrammarData.h \
+    ../../syntak/SyntaxTree.h \
     ../../syntak/Parser.h \
-    MathParser.h
+    ../../syntak/ParsePool.h \
+    ../../syntak/StaticGrammar.h \
+    ../../syntak/ParserGenerator.h \
+    MathParser.h \
+    StaticMathParser.h
 
+# parsers generated by syntak-gen
+GRAMMARS += \
+    calc.syn \
+    calc_ops.syn
+
+include(../../syntak-gen/syntak-gen.pri)
@@ -1,4 +1,7 @@
 TEMPLATE = subdirs
 
 SUBDIRS += \
-	test_math
\ No newline at end of file
+	test_math \
+	bench_lexxer \
+	bench_parsepool \
+	bench_grammar